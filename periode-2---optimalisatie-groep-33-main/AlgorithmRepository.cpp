@@ -1 +1,67 @@
-#include "AlgorithmRepository.h"
\ No newline at end of file
+#include "precomp.h"
+#include "AlgorithmRepository.h"
+
+namespace Tmpl8
+{
+namespace sorting
+{
+
+//Sort a copy of the input with the given sort, check the result and print the time it took
+template <class Value, class Key, class Sort>
+static void time_sort(const char* name, const std::vector<Value>& input, Key key, Sort sort)
+{
+    constexpr int repeats = 10;
+
+    float best = std::numeric_limits<float>::max();
+    std::vector<Value> values;
+    for (int r = 0; r < repeats; r++)
+    {
+        values = input;
+        timer sort_timer;
+        sort(values);
+        best = std::min(best, sort_timer.elapsed());
+    }
+
+    const bool sorted = std::is_sorted(values.begin(), values.end(), [&](const Value& a, const Value& b) { return key(a) < key(b); });
+    cout << "  " << name << ": " << best << " ms" << (sorted ? "" : " (NOT SORTED)") << endl;
+}
+
+void benchmark(const std::vector<Tank>& tanks, int max_health, ThreadPool& pool)
+{
+    //Sort pointers, tanks are too large to move around
+    std::vector<const Tank*> input;
+    for (const Tank& tank : tanks) input.push_back(&tank);
+
+    //Give the tanks a spread of health values like halfway through a battle
+    std::vector<int> health(tanks.size());
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int> distribution(0, max_health);
+    for (int& value : health) value = distribution(generator);
+
+    auto health_key = [&](const Tank* tank) { return health[tank - tanks.data()]; };
+    auto position_key = [](const Tank* tank) { return tank->position.y * SCRWIDTH + tank->position.x; };
+
+    cout << "Sorting " << input.size() << " tanks on health" << endl;
+    time_sort("std::sort", input, health_key, [&](std::vector<const Tank*>& v) { std::sort(v.begin(), v.end(), [&](const Tank* a, const Tank* b) { return health_key(a) < health_key(b); }); });
+    time_sort("quick sort", input, health_key, [&](std::vector<const Tank*>& v) { quick_sort(v.begin(), v.end(), health_key); });
+    time_sort("merge sort", input, health_key, [&](std::vector<const Tank*>& v) { merge_sort(v.begin(), v.end(), health_key); });
+    time_sort("parallel merge sort", input, health_key, [&](std::vector<const Tank*>& v) { parallel_merge_sort(v.begin(), v.end(), pool, health_key); });
+    time_sort("radix sort", input, health_key, [&](std::vector<const Tank*>& v) { radix_sort(v.begin(), v.end(), health_key); });
+    time_sort("bucket sort", input, health_key, [&](std::vector<const Tank*>& v) { bucket_sort(v.begin(), v.end(), 0, max_health, health_key); });
+
+    cout << "Sorting " << input.size() << " tanks on position" << endl;
+    time_sort("std::sort", input, position_key, [&](std::vector<const Tank*>& v) { std::sort(v.begin(), v.end(), [&](const Tank* a, const Tank* b) { return position_key(a) < position_key(b); }); });
+    time_sort("quick sort", input, position_key, [&](std::vector<const Tank*>& v) { quick_sort(v.begin(), v.end(), position_key); });
+    time_sort("merge sort", input, position_key, [&](std::vector<const Tank*>& v) { merge_sort(v.begin(), v.end(), position_key); });
+    time_sort("parallel merge sort", input, position_key, [&](std::vector<const Tank*>& v) { parallel_merge_sort(v.begin(), v.end(), pool, position_key); });
+    time_sort("radix sort", input, position_key, [&](std::vector<const Tank*>& v) { radix_sort(v.begin(), v.end(), position_key); });
+
+    //Insertion sort is quadratic, only time it on a part of the tanks
+    std::vector<const Tank*> small_input(input.begin(), input.begin() + std::min<size_t>(input.size(), 1024));
+    cout << "Sorting " << small_input.size() << " tanks on health" << endl;
+    time_sort("insertion sort", small_input, health_key, [&](std::vector<const Tank*>& v) { insertion_sort(v.begin(), v.end(), health_key); });
+    time_sort("merge sort", small_input, health_key, [&](std::vector<const Tank*>& v) { merge_sort(v.begin(), v.end(), health_key); });
+}
+
+} // namespace sorting
+} // namespace Tmpl8
@@ -1,14 +1,284 @@
 #pragma once
 
-namespace Tmpl18 {
+namespace Tmpl8
+{
+class Tank; //forward declare
 
+namespace sorting
+{
 
-	class AlgoritmRepository {
-		public:
-			void MergeSort();
-			void InsertionSort();
-			void QuickSort();
-			void BucketSort();
-	}
+//Sorting algorithms over iterator ranges, ordered by a key projection: key(element) gives the value to sort on.
+//All sorts are ascending, merge, radix and bucket sort are stable.
 
-}
\ No newline at end of file
+struct identity
+{
+    template <class T>
+    const T& operator()(const T& value) const { return value; }
+};
+
+//Map a key to an unsigned integer with the same ordering, used by radix_sort
+inline uint32_t radix_key(uint32_t key) { return key; }
+inline uint32_t radix_key(int32_t key) { return (uint32_t)key ^ 0x80000000u; }
+inline uint32_t radix_key(float key)
+{
+    uint32_t bits;
+    memcpy(&bits, &key, sizeof(bits));
+    //Negative floats sort reversed, so flip all their bits, positive floats only need the sign bit set
+    return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+// -----------------------------------------------------------
+// Insertion sort, O(n^2) but fast for small or nearly sorted ranges
+// -----------------------------------------------------------
+template <class It, class Key = identity>
+void insertion_sort(It first, It last, Key key = Key())
+{
+    if (first == last) return;
+
+    for (It i = first + 1; i != last; ++i)
+    {
+        auto value = std::move(*i);
+        const auto value_key = key(value);
+
+        It j = i;
+        for (; j != first && value_key < key(*(j - 1)); --j) *j = std::move(*(j - 1));
+        *j = std::move(value);
+    }
+}
+
+// -----------------------------------------------------------
+// Quick sort with median of three pivots, small partitions are
+// finished with insertion sort. Not stable.
+// -----------------------------------------------------------
+template <class It, class Key = identity>
+void quick_sort(It first, It last, Key key = Key())
+{
+    constexpr ptrdiff_t small_range = 16;
+
+    //Recurse on the smaller half and loop on the larger one so the stack stays O(log n)
+    while (last - first > small_range)
+    {
+        It middle = first + (last - first) / 2;
+        It back = last - 1;
+        if (key(*middle) < key(*first)) std::iter_swap(middle, first);
+        if (key(*back) < key(*first)) std::iter_swap(back, first);
+        if (key(*back) < key(*middle)) std::iter_swap(back, middle);
+        const auto pivot = key(*middle);
+
+        //Hoare partition
+        It left = first, right = back;
+        while (true)
+        {
+            while (key(*left) < pivot) ++left;
+            while (pivot < key(*right)) --right;
+            if (!(left < right)) break;
+            std::iter_swap(left, right);
+            ++left;
+            --right;
+        }
+        It split = right + 1;
+
+        if (split - first < last - split)
+        {
+            quick_sort(first, split, key);
+            first = split;
+        }
+        else
+        {
+            quick_sort(split, last, key);
+            last = split;
+        }
+    }
+
+    insertion_sort(first, last, key);
+}
+
+// -----------------------------------------------------------
+// Stable merge sort, buffer must hold last - first elements
+// -----------------------------------------------------------
+template <class It, class Buffer, class Key>
+void merge_sort(It first, It last, Buffer buffer, Key key)
+{
+    constexpr ptrdiff_t small_range = 32;
+
+    const ptrdiff_t count = last - first;
+    if (count <= small_range)
+    {
+        insertion_sort(first, last, key);
+        return;
+    }
+
+    It middle = first + count / 2;
+    merge_sort(first, middle, buffer, key);
+    merge_sort(middle, last, buffer, key);
+
+    //Already in order, happens a lot for nearly sorted input
+    if (!(key(*middle) < key(*(middle - 1)))) return;
+
+    auto compare = [&key](const typename std::iterator_traits<It>::value_type& a, const typename std::iterator_traits<It>::value_type& b) { return key(a) < key(b); };
+    Buffer buffer_end = std::move(first, last, buffer);
+    std::merge(std::make_move_iterator(buffer), std::make_move_iterator(buffer + count / 2),
+               std::make_move_iterator(buffer + count / 2), std::make_move_iterator(buffer_end), first, compare);
+}
+
+template <class It, class Key = identity>
+void merge_sort(It first, It last, Key key = Key())
+{
+    std::vector<typename std::iterator_traits<It>::value_type> buffer(last - first);
+    merge_sort(first, last, buffer.begin(), key);
+}
+
+// -----------------------------------------------------------
+// Stable merge sort on the thread pool: the range is split in one
+// run per thread, the runs are sorted in parallel and then merged
+// pairwise, every merge round in parallel as well.
+// Rounds run with ThreadPool::parallel_for, the calling thread runs
+// queued tasks while it waits, so this may also be called from a
+// worker of the pool.
+// -----------------------------------------------------------
+template <class It, class Key = identity>
+void parallel_merge_sort(It first, It last, ThreadPool& pool, Key key = Key())
+{
+    typedef typename std::iterator_traits<It>::value_type Value;
+    constexpr ptrdiff_t min_run = 1024;
+
+    const ptrdiff_t count = last - first;
+    const ptrdiff_t run_count = std::max<ptrdiff_t>(1, std::min<ptrdiff_t>(pool.size() + 1, count / min_run));
+    if (run_count == 1)
+    {
+        merge_sort(first, last, key);
+        return;
+    }
+
+    std::vector<Value> buffer(count);
+    std::vector<ptrdiff_t> bounds(run_count + 1);
+    for (ptrdiff_t r = 0; r <= run_count; r++) bounds[r] = count * r / run_count;
+
+    //Sort the runs, one run per chunk, every run uses its own part of the buffer as scratch space
+    pool.parallel_for(0, (size_t)run_count, 1, [&](size_t r) {
+        merge_sort(first + bounds[r], first + bounds[r + 1], buffer.begin() + bounds[r], key);
+    });
+
+    //Merge neighbouring runs, ping-ponging between the range and the buffer
+    auto compare = [&key](const Value& a, const Value& b) { return key(a) < key(b); };
+    bool in_buffer = false;
+    for (ptrdiff_t width = 1; width < run_count; width *= 2)
+    {
+        const ptrdiff_t merges = (run_count + 2 * width - 1) / (2 * width);
+        pool.parallel_for(0, (size_t)merges, 1, [&](size_t i) {
+            const ptrdiff_t m = (ptrdiff_t)i;
+            const ptrdiff_t begin = bounds[m * 2 * width];
+            const ptrdiff_t middle = bounds[std::min(run_count, m * 2 * width + width)];
+            const ptrdiff_t end = bounds[std::min(run_count, m * 2 * width + 2 * width)];
+            if (in_buffer)
+                std::merge(std::make_move_iterator(buffer.begin() + begin), std::make_move_iterator(buffer.begin() + middle),
+                           std::make_move_iterator(buffer.begin() + middle), std::make_move_iterator(buffer.begin() + end), first + begin, compare);
+            else
+                std::merge(std::make_move_iterator(first + begin), std::make_move_iterator(first + middle),
+                           std::make_move_iterator(first + middle), std::make_move_iterator(first + end), buffer.begin() + begin, compare);
+        });
+        in_buffer = !in_buffer;
+    }
+
+    if (in_buffer) std::move(buffer.begin(), buffer.end(), first);
+}
+
+// -----------------------------------------------------------
+// LSD radix sort on 8 bit digits, radix_key(key(element)) must be
+// a 32 bit unsigned integer. Digits that are the same for every
+// element are skipped.
+// -----------------------------------------------------------
+template <class It, class Key = identity>
+void radix_sort(It first, It last, Key key = Key())
+{
+    typedef typename std::iterator_traits<It>::value_type Value;
+
+    const size_t count = last - first;
+    if (count < 2) return;
+
+    std::vector<Value> buffer(count);
+    std::vector<uint32_t> keys(count), buffer_keys(count);
+
+    //Histogram of all four digits in one pass
+    std::array<std::array<size_t, 256>, 4> histograms = {};
+    for (size_t i = 0; i < count; i++)
+    {
+        keys[i] = radix_key(key(first[i]));
+        for (int digit = 0; digit < 4; digit++) histograms[digit][(keys[i] >> (digit * 8)) & 0xff]++;
+    }
+
+    bool in_buffer = false;
+    for (int digit = 0; digit < 4; digit++)
+    {
+        std::array<size_t, 256>& histogram = histograms[digit];
+        const int shift = digit * 8;
+
+        //Every element has the same digit, the order does not change
+        const uint32_t first_digit = ((in_buffer ? buffer_keys[0] : keys[0]) >> shift) & 0xff;
+        if (histogram[first_digit] == count) continue;
+
+        //Histogram to start offsets
+        size_t offset = 0;
+        for (size_t& bucket : histogram)
+        {
+            const size_t bucket_count = bucket;
+            bucket = offset;
+            offset += bucket_count;
+        }
+
+        if (in_buffer)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                const size_t target = histogram[(buffer_keys[i] >> shift) & 0xff]++;
+                first[target] = std::move(buffer[i]);
+                keys[target] = buffer_keys[i];
+            }
+        }
+        else
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                const size_t target = histogram[(keys[i] >> shift) & 0xff]++;
+                buffer[target] = std::move(first[i]);
+                buffer_keys[target] = keys[i];
+            }
+        }
+        in_buffer = !in_buffer;
+    }
+
+    if (in_buffer) std::move(buffer.begin(), buffer.end(), first);
+}
+
+// -----------------------------------------------------------
+// Bucket (counting) sort for integer keys in [min_key, max_key],
+// O(n + max_key - min_key). Keys outside the range are clamped.
+// -----------------------------------------------------------
+template <class It, class Key = identity>
+void bucket_sort(It first, It last, int min_key, int max_key, Key key = Key())
+{
+    typedef typename std::iterator_traits<It>::value_type Value;
+
+    const size_t count = last - first;
+    if (count < 2) return;
+
+    auto bucket_of = [&](const Value& value) { return (size_t)(std::max(min_key, std::min((int)key(value), max_key)) - min_key); };
+
+    std::vector<size_t> offsets(max_key - min_key + 2, 0);
+    for (It i = first; i != last; ++i) offsets[bucket_of(*i) + 1]++;
+    for (size_t b = 1; b < offsets.size(); b++) offsets[b] += offsets[b - 1];
+
+    std::vector<Value> buffer(count);
+    for (It i = first; i != last; ++i)
+    {
+        const size_t bucket = bucket_of(*i);
+        buffer[offsets[bucket]++] = std::move(*i);
+    }
+    std::move(buffer.begin(), buffer.end(), first);
+}
+
+//Time all sorts on the health and position keys of the given tanks and print the results
+void benchmark(const std::vector<Tank>& tanks, int max_health, ThreadPool& pool);
+
+} // namespace sorting
+} // namespace Tmpl8
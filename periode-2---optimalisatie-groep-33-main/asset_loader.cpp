@@ -0,0 +1,23 @@
+#include "precomp.h"
+#include "asset_loader.h"
+
+namespace Tmpl8
+{
+
+AssetLoader::SurfaceHandle AssetLoader::load(const char* file)
+{
+    //Every decode has its own FreeImage bitmap, FreeImage only shares its (read only) plugin list
+    std::string path = file;
+    return pool.enqueue([path] { return std::make_unique<Surface>(path.c_str()); });
+}
+
+std::unique_ptr<Surface> AssetLoader::get(SurfaceHandle& handle)
+{
+    while (handle.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+    {
+        if (!pool.run_one()) std::this_thread::yield();
+    }
+    return handle.get();
+}
+
+} // namespace Tmpl8
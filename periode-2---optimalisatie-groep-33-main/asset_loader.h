@@ -0,0 +1,29 @@
+#pragma once
+
+namespace Tmpl8
+{
+
+// -----------------------------------------------------------
+// Decodes image files on the thread pool. load only queues the
+// decode and returns a handle, so when all images are requested
+// before the first one is needed they are decoded at the same
+// time and loading takes about as long as the slowest decode.
+// -----------------------------------------------------------
+class AssetLoader
+{
+  public:
+    typedef std::future<std::unique_ptr<Surface>> SurfaceHandle;
+
+    explicit AssetLoader(ThreadPool& pool) : pool(pool) {}
+
+    //Start decoding an image file
+    SurfaceHandle load(const char* file);
+
+    //Wait until the image is decoded and take it, the calling thread runs queued decodes meanwhile
+    std::unique_ptr<Surface> get(SurfaceHandle& handle);
+
+  private:
+    ThreadPool& pool;
+};
+
+} // namespace Tmpl8
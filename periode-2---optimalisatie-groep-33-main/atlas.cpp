@@ -0,0 +1,88 @@
+#include "precomp.h"
+#include "atlas.h"
+
+namespace Tmpl8
+{
+
+void SpriteAtlas::add(Sprite* sprite)
+{
+    sprites.push_back(sprite);
+}
+
+const SpriteAtlas::Rect& SpriteAtlas::frame_rect(const Sprite* sprite, unsigned int frame) const
+{
+    const size_t index = std::find(sprites.begin(), sprites.end(), sprite) - sprites.begin();
+    return frame_rects.at(index).at(frame);
+}
+
+// -----------------------------------------------------------
+// Shelf packing: frames sorted from tall to short are placed
+// left to right on rows ("shelves") as high as their tallest frame
+// -----------------------------------------------------------
+void SpriteAtlas::build()
+{
+    struct Frame
+    {
+        size_t sprite;
+        unsigned int frame;
+    };
+
+    std::vector<Frame> order;
+    frame_rects.assign(sprites.size(), std::vector<Rect>());
+    for (size_t s = 0; s < sprites.size(); s++)
+    {
+        frame_rects[s].resize(sprites[s]->frames());
+        for (unsigned int f = 0; f < sprites[s]->frames(); f++) order.push_back({s, f});
+    }
+
+    //Stable, so the frames of one sprite stay next to each other
+    std::stable_sort(order.begin(), order.end(), [&](const Frame& a, const Frame& b) { return sprites[a.sprite]->get_height() > sprites[b.sprite]->get_height(); });
+
+    int width = atlas_width;
+    for (Sprite* sprite : sprites) width = std::max(width, (sprite->get_width() + frame_alignment - 1) / frame_alignment * frame_alignment);
+
+    int shelf_x = 0, shelf_y = 0, shelf_height = 0;
+    for (const Frame& frame : order)
+    {
+        Sprite* sprite = sprites[frame.sprite];
+        if (shelf_x + sprite->get_width() > width)
+        {
+            shelf_y += shelf_height;
+            shelf_x = shelf_height = 0;
+        }
+
+        frame_rects[frame.sprite][frame.frame] = {shelf_x, shelf_y, sprite->get_width(), sprite->get_height()};
+
+        shelf_x += (sprite->get_width() + frame_alignment - 1) / frame_alignment * frame_alignment;
+        shelf_height = std::max(shelf_height, sprite->get_height());
+    }
+
+    //Width is a multiple of 16 pixels, so every line starts 64 byte aligned
+    width = (width + 15) & ~15;
+    const int height = std::max(shelf_y + shelf_height, 1);
+
+    surface = std::make_unique<Surface>(width, height);
+    surface->clear(0);
+
+    //Copy the frames and move the sprites over to the atlas
+    for (size_t s = 0; s < sprites.size(); s++)
+    {
+        Sprite* sprite = sprites[s];
+        const int source_pitch = sprite->get_surface()->get_pitch();
+
+        std::vector<int> offsets;
+        for (unsigned int f = 0; f < sprite->frames(); f++)
+        {
+            const Rect& rect = frame_rects[s][f];
+            const Pixel* source = sprite->get_frame(f);
+            Pixel* destination = surface->get_buffer() + rect.x + rect.y * width;
+            for (int y = 0; y < rect.height; y++) memcpy(destination + y * width, source + y * source_pitch, rect.width * sizeof(Pixel));
+
+            offsets.push_back(rect.x + rect.y * width);
+        }
+
+        sprite->set_source(surface.get(), offsets);
+    }
+}
+
+} // namespace Tmpl8
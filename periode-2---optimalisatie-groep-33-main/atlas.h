@@ -0,0 +1,37 @@
+#pragma once
+
+namespace Tmpl8
+{
+
+//Packs the frames of many sprites into one aligned surface, so all sprite pixels
+//live in a single allocation that stays warm in the cache while drawing
+class SpriteAtlas
+{
+  public:
+    //Location of a frame inside the atlas surface, in pixels
+    struct Rect
+    {
+        int x, y, width, height;
+    };
+
+    //Register a sprite, its frames are copied into the atlas by build()
+    void add(Sprite* sprite);
+
+    //Pack all registered frames and point the sprites at the atlas
+    void build();
+
+    Surface* get_surface() const { return surface.get(); }
+    const Rect& frame_rect(const Sprite* sprite, unsigned int frame) const;
+
+  private:
+    //Frame starts are aligned to 4 pixels (16 bytes)
+    static constexpr int frame_alignment = 4;
+    static constexpr int atlas_width = 512;
+
+    std::vector<Sprite*> sprites;
+    std::vector<std::vector<Rect>> frame_rects;
+
+    std::unique_ptr<Surface> surface;
+};
+
+} // namespace Tmpl8
@@ -0,0 +1,441 @@
+#include "precomp.h"
+#include "blit.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC allows AVX2 intrinsics in any function
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace Tmpl8
+{
+
+// -----------------------------------------------------------
+// Scalar kernels, these define the expected results
+// -----------------------------------------------------------
+static void blit_keyed_scalar(Pixel* a_Dst, const Pixel* a_Src, int a_Count)
+{
+    for (int i = 0; i < a_Count; i++)
+        if (a_Src[i] & 0xffffff) a_Dst[i] = a_Src[i];
+}
+
+static void blit_add_keyed_scalar(Pixel* a_Dst, const Pixel* a_Src, int a_Count)
+{
+    for (int i = 0; i < a_Count; i++)
+        if (a_Src[i] & 0xffffff) a_Dst[i] = add_blend(a_Src[i], a_Dst[i]);
+}
+
+static void blend_add_span_scalar(Pixel* a_Dst, const Pixel* a_Src, int a_Count)
+{
+    for (int i = 0; i < a_Count; i++) a_Dst[i] = add_blend(a_Dst[i], a_Src[i]);
+}
+
+static void blend_sub_span_scalar(Pixel* a_Dst, const Pixel* a_Src, int a_Count)
+{
+    for (int i = 0; i < a_Count; i++) a_Dst[i] = sub_blend(a_Dst[i], a_Src[i]);
+}
+
+static void scale_span_scalar(Pixel* a_Dst, int a_Count, unsigned int a_Scale)
+{
+    for (int i = 0; i < a_Count; i++)
+    {
+        Pixel result = 0;
+        for (int shift = 0; shift < 24; shift += 8)
+        {
+            const unsigned int channel = (((a_Dst[i] >> shift) & 0xff) * a_Scale) >> 5;
+            result |= std::min(channel, 255u) << shift;
+        }
+        a_Dst[i] = result;
+    }
+}
+
+// x / 255 rounded, exact for x <= 255 * 255
+static inline unsigned int div255(unsigned int x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+static void alpha_over_span_scalar(Pixel* a_Dst, const Pixel* a_Src, int a_Count)
+{
+    for (int i = 0; i < a_Count; i++)
+    {
+        const unsigned int alpha = a_Src[i] >> 24;
+        Pixel result = 0;
+        for (int shift = 0; shift < 24; shift += 8)
+        {
+            const unsigned int src = (a_Src[i] >> shift) & 0xff, dst = (a_Dst[i] >> shift) & 0xff;
+            result |= div255(src * alpha + dst * (255 - alpha)) << shift;
+        }
+        a_Dst[i] = result;
+    }
+}
+
+// -----------------------------------------------------------
+// SSE2 kernels (4 pixels at a time), always available on x64
+// -----------------------------------------------------------
+static void blit_keyed_sse2(Pixel* a_Dst, const Pixel* a_Src, int a_Count)
+{
+    const __m128i rgb = _mm_set1_epi32(0xffffff);
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 4 <= a_Count; i += 4)
+    {
+        const __m128i src = _mm_loadu_si128((const __m128i*)(a_Src + i));
+        const __m128i dst = _mm_loadu_si128((const __m128i*)(a_Dst + i));
+        // All ones for transparent pixels, keep the destination there
+        const __m128i transparent = _mm_cmpeq_epi32(_mm_and_si128(src, rgb), zero);
+        _mm_storeu_si128((__m128i*)(a_Dst + i), _mm_or_si128(_mm_and_si128(transparent, dst), _mm_andnot_si128(transparent, src)));
+    }
+    blit_keyed_scalar(a_Dst + i, a_Src + i, a_Count - i);
+}
+
+static void blit_add_keyed_sse2(Pixel* a_Dst, const Pixel* a_Src, int a_Count)
+{
+    const __m128i rgb = _mm_set1_epi32(0xffffff);
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 4 <= a_Count; i += 4)
+    {
+        const __m128i src = _mm_loadu_si128((const __m128i*)(a_Src + i));
+        const __m128i dst = _mm_loadu_si128((const __m128i*)(a_Dst + i));
+        const __m128i transparent = _mm_cmpeq_epi32(_mm_and_si128(src, rgb), zero);
+        // Saturating add per channel, add_blend clears the alpha byte
+        const __m128i sum = _mm_and_si128(_mm_adds_epu8(src, dst), rgb);
+        _mm_storeu_si128((__m128i*)(a_Dst + i), _mm_or_si128(_mm_and_si128(transparent, dst), _mm_andnot_si128(transparent, sum)));
+    }
+    blit_add_keyed_scalar(a_Dst + i, a_Src + i, a_Count - i);
+}
+
+static void blend_add_span_sse2(Pixel* a_Dst, const Pixel* a_Src, int a_Count)
+{
+    const __m128i rgb = _mm_set1_epi32(0xffffff);
+    int i = 0;
+    for (; i + 4 <= a_Count; i += 4)
+    {
+        const __m128i src = _mm_loadu_si128((const __m128i*)(a_Src + i));
+        const __m128i dst = _mm_loadu_si128((const __m128i*)(a_Dst + i));
+        _mm_storeu_si128((__m128i*)(a_Dst + i), _mm_and_si128(_mm_adds_epu8(dst, src), rgb));
+    }
+    blend_add_span_scalar(a_Dst + i, a_Src + i, a_Count - i);
+}
+
+static void blend_sub_span_sse2(Pixel* a_Dst, const Pixel* a_Src, int a_Count)
+{
+    const __m128i rgb = _mm_set1_epi32(0xffffff);
+    int i = 0;
+    for (; i + 4 <= a_Count; i += 4)
+    {
+        const __m128i src = _mm_loadu_si128((const __m128i*)(a_Src + i));
+        const __m128i dst = _mm_loadu_si128((const __m128i*)(a_Dst + i));
+        _mm_storeu_si128((__m128i*)(a_Dst + i), _mm_and_si128(_mm_subs_epu8(dst, src), rgb));
+    }
+    blend_sub_span_scalar(a_Dst + i, a_Src + i, a_Count - i);
+}
+
+// Channels are widened to 16 bits as c << 8, the high half of (c << 8) * (scale << 3) is c * scale / 32
+static void scale_span_sse2(Pixel* a_Dst, int a_Count, unsigned int a_Scale)
+{
+    const __m128i rgb = _mm_set1_epi32(0xffffff);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i scale = _mm_set1_epi16((short)(a_Scale << 3));
+    int i = 0;
+    for (; i + 4 <= a_Count; i += 4)
+    {
+        const __m128i dst = _mm_loadu_si128((const __m128i*)(a_Dst + i));
+        const __m128i lo = _mm_mulhi_epu16(_mm_unpacklo_epi8(zero, dst), scale);
+        const __m128i hi = _mm_mulhi_epu16(_mm_unpackhi_epi8(zero, dst), scale);
+        _mm_storeu_si128((__m128i*)(a_Dst + i), _mm_and_si128(_mm_packus_epi16(lo, hi), rgb));
+    }
+    scale_span_scalar(a_Dst + i, a_Count - i, a_Scale);
+}
+
+// Blend 2 pixels widened to 16 bits per channel
+static inline __m128i alpha_over_sse2(__m128i src, __m128i dst)
+{
+    const __m128i max = _mm_set1_epi16(255);
+    const __m128i half = _mm_set1_epi16(128);
+    const __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(src, 0xff), 0xff);
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(src, alpha), _mm_mullo_epi16(dst, _mm_sub_epi16(max, alpha)));
+    sum = _mm_add_epi16(sum, half);
+    return _mm_srli_epi16(_mm_add_epi16(sum, _mm_srli_epi16(sum, 8)), 8);
+}
+
+static void alpha_over_span_sse2(Pixel* a_Dst, const Pixel* a_Src, int a_Count)
+{
+    const __m128i rgb = _mm_set1_epi32(0xffffff);
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 4 <= a_Count; i += 4)
+    {
+        const __m128i src = _mm_loadu_si128((const __m128i*)(a_Src + i));
+        const __m128i dst = _mm_loadu_si128((const __m128i*)(a_Dst + i));
+        const __m128i lo = alpha_over_sse2(_mm_unpacklo_epi8(src, zero), _mm_unpacklo_epi8(dst, zero));
+        const __m128i hi = alpha_over_sse2(_mm_unpackhi_epi8(src, zero), _mm_unpackhi_epi8(dst, zero));
+        _mm_storeu_si128((__m128i*)(a_Dst + i), _mm_and_si128(_mm_packus_epi16(lo, hi), rgb));
+    }
+    alpha_over_span_scalar(a_Dst + i, a_Src + i, a_Count - i);
+}
+
+// -----------------------------------------------------------
+// AVX2 kernels (8 pixels at a time)
+// -----------------------------------------------------------
+TARGET_AVX2 static void blit_keyed_avx2(Pixel* a_Dst, const Pixel* a_Src, int a_Count)
+{
+    const __m256i rgb = _mm256_set1_epi32(0xffffff);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi32(-1);
+    int i = 0;
+    for (; i + 8 <= a_Count; i += 8)
+    {
+        const __m256i src = _mm256_loadu_si256((const __m256i*)(a_Src + i));
+        // Only write the opaque pixels, transparent ones are not touched at all
+        const __m256i opaque = _mm256_xor_si256(_mm256_cmpeq_epi32(_mm256_and_si256(src, rgb), zero), ones);
+        _mm256_maskstore_epi32((int*)(a_Dst + i), opaque, src);
+    }
+    blit_keyed_sse2(a_Dst + i, a_Src + i, a_Count - i);
+}
+
+TARGET_AVX2 static void blit_add_keyed_avx2(Pixel* a_Dst, const Pixel* a_Src, int a_Count)
+{
+    const __m256i rgb = _mm256_set1_epi32(0xffffff);
+    const __m256i zero = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 8 <= a_Count; i += 8)
+    {
+        const __m256i src = _mm256_loadu_si256((const __m256i*)(a_Src + i));
+        const __m256i dst = _mm256_loadu_si256((const __m256i*)(a_Dst + i));
+        const __m256i transparent = _mm256_cmpeq_epi32(_mm256_and_si256(src, rgb), zero);
+        const __m256i sum = _mm256_and_si256(_mm256_adds_epu8(src, dst), rgb);
+        _mm256_storeu_si256((__m256i*)(a_Dst + i), _mm256_blendv_epi8(sum, dst, transparent));
+    }
+    blit_add_keyed_sse2(a_Dst + i, a_Src + i, a_Count - i);
+}
+
+TARGET_AVX2 static void blend_add_span_avx2(Pixel* a_Dst, const Pixel* a_Src, int a_Count)
+{
+    const __m256i rgb = _mm256_set1_epi32(0xffffff);
+    int i = 0;
+    for (; i + 8 <= a_Count; i += 8)
+    {
+        const __m256i src = _mm256_loadu_si256((const __m256i*)(a_Src + i));
+        const __m256i dst = _mm256_loadu_si256((const __m256i*)(a_Dst + i));
+        _mm256_storeu_si256((__m256i*)(a_Dst + i), _mm256_and_si256(_mm256_adds_epu8(dst, src), rgb));
+    }
+    blend_add_span_sse2(a_Dst + i, a_Src + i, a_Count - i);
+}
+
+TARGET_AVX2 static void blend_sub_span_avx2(Pixel* a_Dst, const Pixel* a_Src, int a_Count)
+{
+    const __m256i rgb = _mm256_set1_epi32(0xffffff);
+    int i = 0;
+    for (; i + 8 <= a_Count; i += 8)
+    {
+        const __m256i src = _mm256_loadu_si256((const __m256i*)(a_Src + i));
+        const __m256i dst = _mm256_loadu_si256((const __m256i*)(a_Dst + i));
+        _mm256_storeu_si256((__m256i*)(a_Dst + i), _mm256_and_si256(_mm256_subs_epu8(dst, src), rgb));
+    }
+    blend_sub_span_sse2(a_Dst + i, a_Src + i, a_Count - i);
+}
+
+TARGET_AVX2 static void scale_span_avx2(Pixel* a_Dst, int a_Count, unsigned int a_Scale)
+{
+    const __m256i rgb = _mm256_set1_epi32(0xffffff);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i scale = _mm256_set1_epi16((short)(a_Scale << 3));
+    int i = 0;
+    for (; i + 8 <= a_Count; i += 8)
+    {
+        // Unpack and pack both work per 128 bit lane, so the pixel order is kept
+        const __m256i dst = _mm256_loadu_si256((const __m256i*)(a_Dst + i));
+        const __m256i lo = _mm256_mulhi_epu16(_mm256_unpacklo_epi8(zero, dst), scale);
+        const __m256i hi = _mm256_mulhi_epu16(_mm256_unpackhi_epi8(zero, dst), scale);
+        _mm256_storeu_si256((__m256i*)(a_Dst + i), _mm256_and_si256(_mm256_packus_epi16(lo, hi), rgb));
+    }
+    scale_span_sse2(a_Dst + i, a_Count - i, a_Scale);
+}
+
+TARGET_AVX2 static inline __m256i alpha_over_avx2(__m256i src, __m256i dst)
+{
+    const __m256i max = _mm256_set1_epi16(255);
+    const __m256i half = _mm256_set1_epi16(128);
+    const __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(src, 0xff), 0xff);
+    __m256i sum = _mm256_add_epi16(_mm256_mullo_epi16(src, alpha), _mm256_mullo_epi16(dst, _mm256_sub_epi16(max, alpha)));
+    sum = _mm256_add_epi16(sum, half);
+    return _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_srli_epi16(sum, 8)), 8);
+}
+
+TARGET_AVX2 static void alpha_over_span_avx2(Pixel* a_Dst, const Pixel* a_Src, int a_Count)
+{
+    const __m256i rgb = _mm256_set1_epi32(0xffffff);
+    const __m256i zero = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 8 <= a_Count; i += 8)
+    {
+        const __m256i src = _mm256_loadu_si256((const __m256i*)(a_Src + i));
+        const __m256i dst = _mm256_loadu_si256((const __m256i*)(a_Dst + i));
+        const __m256i lo = alpha_over_avx2(_mm256_unpacklo_epi8(src, zero), _mm256_unpacklo_epi8(dst, zero));
+        const __m256i hi = alpha_over_avx2(_mm256_unpackhi_epi8(src, zero), _mm256_unpackhi_epi8(dst, zero));
+        _mm256_storeu_si256((__m256i*)(a_Dst + i), _mm256_and_si256(_mm256_packus_epi16(lo, hi), rgb));
+    }
+    alpha_over_span_sse2(a_Dst + i, a_Src + i, a_Count - i);
+}
+
+// -----------------------------------------------------------
+// Runtime dispatch
+// -----------------------------------------------------------
+bool cpu_has_avx2()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    // The OS has to save the YMM registers (OSXSAVE + XCR0 bits 1 and 2)
+    if (!(info[2] & (1 << 27)) || ((_xgetbv(0) & 6) != 6)) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+struct BlitKernels
+{
+    void (*keyed)(Pixel*, const Pixel*, int);
+    void (*add_keyed)(Pixel*, const Pixel*, int);
+    void (*add)(Pixel*, const Pixel*, int);
+    void (*sub)(Pixel*, const Pixel*, int);
+    void (*scale)(Pixel*, int, unsigned int);
+    void (*alpha_over)(Pixel*, const Pixel*, int);
+    const char* name;
+};
+
+static const BlitKernels avx2_kernels{blit_keyed_avx2, blit_add_keyed_avx2, blend_add_span_avx2, blend_sub_span_avx2, scale_span_avx2, alpha_over_span_avx2, "AVX2"};
+static const BlitKernels sse2_kernels{blit_keyed_sse2, blit_add_keyed_sse2, blend_add_span_sse2, blend_sub_span_sse2, scale_span_sse2, alpha_over_span_sse2, "SSE2"};
+
+//Set by blit_force_instruction_set, null picks the best set of the CPU
+static const BlitKernels* forced_kernels = nullptr;
+
+static const BlitKernels& kernels()
+{
+    if (forced_kernels) return *forced_kernels;
+    static const BlitKernels& detected = cpu_has_avx2() ? avx2_kernels : sse2_kernels;
+    return detected;
+}
+
+bool blit_force_instruction_set(const char* a_Name)
+{
+    if (!a_Name)
+        forced_kernels = nullptr;
+    else if (!strcmp(a_Name, "SSE2"))
+        forced_kernels = &sse2_kernels;
+    else if (!strcmp(a_Name, "AVX2") && cpu_has_avx2())
+        forced_kernels = &avx2_kernels;
+    else
+        return false;
+    return true;
+}
+
+void blit_keyed(Pixel* a_Dst, const Pixel* a_Src, int a_Count)
+{
+    kernels().keyed(a_Dst, a_Src, a_Count);
+}
+
+void blit_add_keyed(Pixel* a_Dst, const Pixel* a_Src, int a_Count)
+{
+    kernels().add_keyed(a_Dst, a_Src, a_Count);
+}
+
+void blend_add_span(Pixel* a_Dst, const Pixel* a_Src, int a_Count)
+{
+    kernels().add(a_Dst, a_Src, a_Count);
+}
+
+void blend_sub_span(Pixel* a_Dst, const Pixel* a_Src, int a_Count)
+{
+    kernels().sub(a_Dst, a_Src, a_Count);
+}
+
+void scale_span(Pixel* a_Dst, int a_Count, unsigned int a_Scale)
+{
+    kernels().scale(a_Dst, a_Count, std::min(a_Scale, 4095u));
+}
+
+void alpha_over_span(Pixel* a_Dst, const Pixel* a_Src, int a_Count)
+{
+    kernels().alpha_over(a_Dst, a_Src, a_Count);
+}
+
+const char* blit_instruction_set()
+{
+    return kernels().name;
+}
+
+// -----------------------------------------------------------
+// Self test, Sprite::draw against the scalar Sprite::draw_reference
+// -----------------------------------------------------------
+bool blit_selftest()
+{
+    std::mt19937 generator(29);
+    auto random_int = [&](int low, int high) { return std::uniform_int_distribution<int>(low, high)(generator); };
+
+    const int target_width = 96, target_height = 64;
+    Surface background(target_width, target_height), expected(target_width, target_height), result(target_width, target_height);
+
+    bool passed = true;
+    for (const char* instruction_set : {"SSE2", "AVX2"})
+    {
+        if (!blit_force_instruction_set(instruction_set))
+        {
+            printf("blit selftest: %s not supported, skipped\n", instruction_set);
+            continue;
+        }
+
+        int mismatches = 0, draws = 0;
+        for (int test = 0; test < 200; test++)
+        {
+            //Random frames with transparent runs of random length, so lines have anything from no to many runs
+            const int width = random_int(1, 40), height = random_int(1, 24), frames = random_int(1, 4);
+            Surface image(width * frames, height);
+            Pixel* pixels = image.get_buffer();
+            for (int i = 0; i < width * frames * height;)
+            {
+                const Pixel color = random_int(0, 2) ? ((Pixel)generator() & 0xffffff) : 0;
+                for (int run = random_int(1, 6); run > 0 && i < width * frames * height; run--, i++) pixels[i] = color | ((Pixel)generator() & 0xff000000);
+            }
+            Sprite sprite(&image, frames);
+
+            for (int draw = 0; draw < 20; draw++, draws++)
+            {
+                //Positions partly or fully off every edge of the target
+                const int x = random_int(-width - 4, target_width + 4), y = random_int(-height - 4, target_height + 4);
+                const unsigned int frame = (unsigned int)random_int(0, frames - 1);
+                const unsigned int flags = random_int(0, 1) ? Sprite::FLARE : 0;
+                const int clip_y1 = random_int(0, 1) ? random_int(0, target_height) : 0;
+                const int clip_y2 = random_int(0, 1) ? random_int(clip_y1, target_height) : target_height;
+
+                for (int i = 0; i < target_width * target_height; i++) background.get_buffer()[i] = (Pixel)generator();
+                background.copy_to(&expected, 0, 0);
+                background.copy_to(&result, 0, 0);
+
+                sprite.draw_reference(&expected, x, y, frame, flags, clip_y1, clip_y2);
+                sprite.draw(&result, x, y, frame, flags, clip_y1, clip_y2);
+
+                if (memcmp(expected.get_buffer(), result.get_buffer(), target_width * target_height * sizeof(Pixel)))
+                {
+                    if (mismatches++ < 8) printf("blit selftest: %s mismatch, sprite %dx%d frame %u at (%d, %d) flags %u lines %d-%d\n", instruction_set, width, height, frame, x, y, flags, clip_y1, clip_y2);
+                }
+            }
+        }
+        printf("blit selftest: %s %d/%d draws pixel exact\n", instruction_set, draws - mismatches, draws);
+        passed = passed && (mismatches == 0);
+    }
+
+    blit_force_instruction_set(nullptr);
+    return passed;
+}
+
+} // namespace Tmpl8
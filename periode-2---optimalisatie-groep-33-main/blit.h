@@ -0,0 +1,47 @@
+#pragma once
+
+namespace Tmpl8
+{
+
+// Pixel span kernels used by the sprite blitter and the surface effects. For the keyed blits
+// black pixels (0x000000, alpha ignored) are transparent. The AVX2 or SSE2 version is picked
+// at runtime depending on the CPU.
+
+// Copy the non transparent pixels of a_Src to a_Dst
+void blit_keyed(Pixel* a_Dst, const Pixel* a_Src, int a_Count);
+
+// a_Dst = add_blend(a_Src, a_Dst) for the non transparent pixels of a_Src
+void blit_add_keyed(Pixel* a_Dst, const Pixel* a_Src, int a_Count);
+
+// Colour arithmetic on whole pixel spans, per channel with saturation. The alpha byte of
+// the results is cleared, like add_blend and sub_blend do.
+
+// a_Dst = add_blend(a_Dst, a_Src)
+void blend_add_span(Pixel* a_Dst, const Pixel* a_Src, int a_Count);
+
+// a_Dst = sub_blend(a_Dst, a_Src)
+void blend_sub_span(Pixel* a_Dst, const Pixel* a_Src, int a_Count);
+
+// Every channel becomes min(255, channel * a_Scale / 32), for a_Scale <= 32 this equals scale_color
+// a_Scale is clamped to 4095
+void scale_span(Pixel* a_Dst, int a_Count, unsigned int a_Scale);
+
+// Blend a_Src over a_Dst using the alpha byte of a_Src: (src * alpha + dst * (255 - alpha)) / 255, rounded
+void alpha_over_span(Pixel* a_Dst, const Pixel* a_Src, int a_Count);
+
+// Name of the instruction set the kernels use ("AVX2" or "SSE2")
+const char* blit_instruction_set();
+
+// True when the CPU and OS support AVX2, for other kernels that dispatch at runtime
+bool cpu_has_avx2();
+
+// Use the "AVX2" or "SSE2" kernels instead of the best ones for the CPU (null: back to the best ones).
+// Returns false if the CPU lacks the instruction set. Not thread safe, call while nothing is drawn
+bool blit_force_instruction_set(const char* a_Name);
+
+// Draw random sprites (normal, FLARE, clipped at the edges and lines) with Sprite::draw and with
+// Sprite::draw_reference for every instruction set the CPU has and compare the pixels.
+// Prints the mismatches and returns true if all draws are pixel exact
+bool blit_selftest();
+
+} // namespace Tmpl8
@@ -0,0 +1,187 @@
+#include "precomp.h"
+#include "cpu_topology.h"
+
+namespace Tmpl8
+{
+
+static const std::string sys_cpu = "/sys/devices/system/cpu/";
+
+//Read one integer from a sysfs file, fallback when the file does not exist
+static int read_int(const std::string& path, int fallback)
+{
+    std::ifstream file(path);
+    int value;
+    return (file >> value) ? value : fallback;
+}
+
+//Parse a sysfs CPU list like "0-3,8,10-11"
+static std::vector<int> read_cpu_list(const std::string& path)
+{
+    std::vector<int> cpus;
+    std::ifstream file(path);
+    std::string list;
+    if (!std::getline(file, list)) return cpus;
+
+    std::stringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges, range, ','))
+    {
+        const size_t dash = range.find('-');
+        const int first = atoi(range.c_str());
+        const int last = (dash == std::string::npos) ? first : atoi(range.c_str() + dash + 1);
+        for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+//CPUs this process may run on (taskset, cgroup cpusets, job objects), empty when the system can not tell
+static std::vector<int> affinity_cpu_list()
+{
+    std::vector<int> cpus;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+    }
+#elif defined(_WIN32)
+    DWORD_PTR process_mask, system_mask;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask)) return cpus;
+    for (int cpu = 0; cpu < 64; cpu++)
+    {
+        if (process_mask & (DWORD_PTR(1) << cpu)) cpus.push_back(cpu);
+    }
+#endif
+    return cpus;
+}
+
+//The online CPUs the process is allowed to use, either list alone when the other is unavailable
+static std::vector<int> usable_cpu_list()
+{
+    const std::vector<int> online = read_cpu_list(sys_cpu + "online");
+    const std::vector<int> allowed = affinity_cpu_list();
+    if (online.empty()) return allowed;
+    if (allowed.empty()) return online;
+
+    std::vector<int> usable;
+    for (int id : online)
+    {
+        if (std::find(allowed.begin(), allowed.end(), id) != allowed.end()) usable.push_back(id);
+    }
+    return usable.empty() ? allowed : usable;
+}
+
+CpuTopology CpuTopology::detect()
+{
+    CpuTopology topology;
+
+    for (int id : usable_cpu_list())
+    {
+        const std::string cpu_path = sys_cpu + "cpu" + std::to_string(id) + "/";
+
+        Cpu cpu;
+        cpu.id = id;
+        cpu.package = read_int(cpu_path + "topology/physical_package_id", 0);
+        cpu.core = read_int(cpu_path + "topology/core_id", id);
+
+        //Without an L3 id every package counts as one cache
+        cpu.l3 = cpu.package;
+        for (int index = 0; index < 8; index++)
+        {
+            const std::string cache_path = cpu_path + "cache/index" + std::to_string(index) + "/";
+            if (read_int(cache_path + "level", 0) != 3) continue;
+
+            //Older kernels have no id file, the lowest CPU sharing the cache identifies it as well
+            const std::vector<int> shared = read_cpu_list(cache_path + "shared_cpu_list");
+            cpu.l3 = read_int(cache_path + "id", shared.empty() ? cpu.package : shared.front());
+            break;
+        }
+        topology.cpu_list.push_back(cpu);
+    }
+
+    //NUMA nodes list their CPUs, node ids can have gaps
+    for (int node = 0; node < 256; node++)
+    {
+        for (int id : read_cpu_list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"))
+        {
+            for (Cpu& cpu : topology.cpu_list)
+            {
+                if (cpu.id == id) cpu.node = node;
+            }
+        }
+    }
+
+    //Neither sysfs nor an affinity mask
+    if (topology.cpu_list.empty())
+    {
+        const int count = std::max(1u, std::thread::hardware_concurrency());
+        for (int id = 0; id < count; id++)
+        {
+            Cpu cpu;
+            cpu.id = cpu.core = id;
+            topology.cpu_list.push_back(cpu);
+        }
+    }
+
+    topology.assign_domains();
+    return topology;
+}
+
+void CpuTopology::assign_domains()
+{
+    std::vector<std::pair<int, int>> domain_keys;
+    for (Cpu& cpu : cpu_list)
+    {
+        const std::pair<int, int> key(cpu.node, cpu.l3);
+        auto found = std::find(domain_keys.begin(), domain_keys.end(), key);
+        cpu.domain = (int)(found - domain_keys.begin());
+        if (found == domain_keys.end()) domain_keys.push_back(key);
+
+        //Siblings are numbered in CPU id order
+        cpu.sibling = 0;
+        for (const Cpu& other : cpu_list)
+        {
+            if (other.id < cpu.id && other.package == cpu.package && other.core == cpu.core) cpu.sibling++;
+        }
+    }
+    domains = std::max(1, (int)domain_keys.size());
+}
+
+std::vector<CpuTopology::Cpu> CpuTopology::placement(size_t count) const
+{
+    std::vector<Cpu> order = cpu_list;
+    std::stable_sort(order.begin(), order.end(), [](const Cpu& a, const Cpu& b) {
+        if (a.domain != b.domain) return a.domain < b.domain;
+        return a.sibling < b.sibling;
+    });
+
+    std::vector<Cpu> placed;
+    for (size_t i = 0; i < count; i++) placed.push_back(order[i % order.size()]);
+    return placed;
+}
+
+void CpuTopology::print() const
+{
+    int cores = 0;
+    for (const Cpu& cpu : cpu_list) cores += (cpu.sibling == 0);
+    printf("cpu topology: %zu cpus, %d cores, %d domains (L3 cache per NUMA node)\n", cpu_list.size(), cores, domains);
+}
+
+bool pin_thread(std::thread& thread, int cpu)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+    if (cpu >= 64) return false;
+    return SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << cpu) != 0;
+#else
+    return false;
+#endif
+}
+
+} // namespace Tmpl8
@@ -0,0 +1,55 @@
+#pragma once
+
+namespace Tmpl8
+{
+
+// -----------------------------------------------------------
+// Which logical CPUs share a core, an L3 cache and a NUMA node,
+// read from /sys/devices/system/cpu on Linux. Only the CPUs in
+// the affinity mask of the process count, so taskset and cgroup
+// cpusets limit the threads and pinning as well. On other systems
+// every CPU counts as its own core in one shared domain.
+// A domain is one L3 cache within one NUMA node, threads in the
+// same domain share data cheaply, threads in different domains
+// go through the interconnect.
+// -----------------------------------------------------------
+class CpuTopology
+{
+  public:
+    struct Cpu
+    {
+        int id = 0;
+        int package = 0;
+        int core = 0;
+        int l3 = 0;
+        int node = 0;
+
+        //Index of the (node, l3) pair
+        int domain = 0;
+
+        //0 for the first logical CPU of a core, 1 for its SMT sibling, ...
+        int sibling = 0;
+    };
+
+    static CpuTopology detect();
+
+    const std::vector<Cpu>& cpus() const { return cpu_list; }
+    int domain_count() const { return domains; }
+
+    //CPUs for count threads: domain by domain, within a domain one per core before using SMT siblings
+    //Wraps around when there are more threads than CPUs
+    std::vector<Cpu> placement(size_t count) const;
+
+    void print() const;
+
+  private:
+    void assign_domains();
+
+    std::vector<Cpu> cpu_list;
+    int domains = 1;
+};
+
+//Restrict a thread to one CPU, returns false when that is not supported
+bool pin_thread(std::thread& thread, int cpu);
+
+} // namespace Tmpl8
@@ -0,0 +1,204 @@
+#include "precomp.h"
+#include "ecs.h"
+
+namespace Tmpl8
+{
+namespace ecs
+{
+
+static size_t align_up(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// -----------------------------------------------------------
+// Archetype
+// -----------------------------------------------------------
+Archetype::Archetype(Signature signature, std::vector<const ComponentInfo*> component_infos)
+    : signature_(signature), infos(std::move(component_infos))
+{
+    column_of.fill(-1);
+
+    //Sort by id so every permutation of the same components gets the same layout
+    std::sort(infos.begin(), infos.end(), [](const ComponentInfo* a, const ComponentInfo* b) { return a->id < b->id; });
+
+    size_t row_bytes = sizeof(Entity);
+    for (const ComponentInfo* info : infos) row_bytes += info->size;
+
+    //Find the largest amount of rows for which all aligned columns fit in one chunk
+    rows_per_chunk = std::max<size_t>(1, chunk_bytes / row_bytes);
+    while (true)
+    {
+        offsets.clear();
+        size_t offset = sizeof(Entity) * rows_per_chunk;
+        for (const ComponentInfo* info : infos)
+        {
+            offset = align_up(offset, info->alignment);
+            offsets.push_back(offset);
+            offset += info->size * rows_per_chunk;
+        }
+
+        if (offset <= chunk_bytes || rows_per_chunk == 1) break;
+        rows_per_chunk--;
+    }
+
+    for (size_t i = 0; i < infos.size(); i++) column_of[infos[i]->id] = (int)i;
+}
+
+Archetype::~Archetype()
+{
+    for (size_t row = 0; row < count; row++)
+    {
+        for (const ComponentInfo* info : infos) info->destroy(component(info->id, row));
+    }
+
+    for (unsigned char* chunk : chunks) FREE64(chunk);
+}
+
+void* Archetype::component(uint32_t id, size_t row)
+{
+    assert(column_of[id] >= 0);
+    const size_t column = column_of[id];
+    return chunks[row / rows_per_chunk] + offsets[column] + (row % rows_per_chunk) * infos[column]->size;
+}
+
+size_t Archetype::push(Entity new_entity)
+{
+    //Chunks are kept around after entities are erased, so only allocate when all of them are full
+    if (count == chunks.size() * rows_per_chunk)
+    {
+        const size_t bytes = std::max(chunk_bytes, align_up(offsets.empty() ? sizeof(Entity) : offsets.back() + infos.back()->size, 64));
+        chunks.push_back((unsigned char*)MALLOC64(bytes));
+    }
+
+    entity(count) = new_entity;
+    return count++;
+}
+
+// -----------------------------------------------------------
+// World
+// -----------------------------------------------------------
+World::~World()
+{
+    //Archetypes destroy their own components
+}
+
+Archetype& World::archetype_for(Signature signature, std::vector<const ComponentInfo*> infos)
+{
+    auto found = archetype_lookup.find(signature);
+    if (found != archetype_lookup.end()) return *found->second;
+
+    archetypes.push_back(std::make_unique<Archetype>(signature, std::move(infos)));
+    archetype_lookup[signature] = archetypes.back().get();
+    return *archetypes.back();
+}
+
+Entity World::allocate_entity()
+{
+    Entity entity;
+    if (!free_indices.empty())
+    {
+        entity.index = free_indices.back();
+        free_indices.pop_back();
+    }
+    else
+    {
+        entity.index = (uint32_t)records.size();
+        records.emplace_back();
+    }
+    entity.generation = records[entity.index].generation;
+
+    alive_count++;
+    return entity;
+}
+
+bool World::alive(Entity entity) const
+{
+    return entity.index < records.size() && records[entity.index].archetype != nullptr && records[entity.index].generation == entity.generation;
+}
+
+void World::destroy(Entity entity)
+{
+    std::lock_guard<std::mutex> lock(destroy_mutex);
+    pending_destroy.push_back(entity);
+}
+
+void World::flush()
+{
+    if (pending_destroy.empty()) return;
+
+    //Group the rows to remove per archetype
+    std::unordered_map<Archetype*, std::vector<size_t>> removed_rows;
+    for (Entity entity : pending_destroy)
+    {
+        //Entities can be destroyed more than once in a frame
+        if (!alive(entity)) continue;
+
+        Record& record = records[entity.index];
+        removed_rows[record.archetype].push_back(record.row);
+
+        record.archetype = nullptr;
+        record.generation++;
+        free_indices.push_back(entity.index);
+        alive_count--;
+    }
+    pending_destroy.clear();
+
+    for (auto& removed : removed_rows)
+    {
+        std::sort(removed.second.begin(), removed.second.end());
+        removed.first->erase(removed.second, [&](Entity entity, size_t row) { records[entity.index].row = row; });
+    }
+}
+
+// -----------------------------------------------------------
+// Scheduler
+// -----------------------------------------------------------
+void Scheduler::add_system(const char* name, Signature reads, Signature writes, SystemFunction function)
+{
+    systems.push_back({name, reads, writes, std::move(function)});
+    stages_dirty = true;
+}
+
+bool Scheduler::conflicts(const System& a, const System& b)
+{
+    return (a.writes & (b.reads | b.writes)) || (b.writes & a.reads);
+}
+
+//Put every system in the first stage after the last stage that holds a system it conflicts with
+void Scheduler::build_stages()
+{
+    stages.clear();
+    std::vector<size_t> stage_of(systems.size(), 0);
+
+    for (size_t i = 0; i < systems.size(); i++)
+    {
+        size_t stage = 0;
+        for (size_t j = 0; j < i; j++)
+        {
+            if (conflicts(systems[i], systems[j])) stage = std::max(stage, stage_of[j] + 1);
+        }
+
+        stage_of[i] = stage;
+        if (stages.size() <= stage) stages.resize(stage + 1);
+        stages[stage].push_back(i);
+    }
+
+    stages_dirty = false;
+}
+
+void Scheduler::run(World& world, ThreadPool& pool)
+{
+    if (stages_dirty) build_stages();
+
+    for (const std::vector<size_t>& stage : stages)
+    {
+        //Systems of a stage are independent, the calling thread takes part so this can run inside a task
+        pool.parallel_for(0, stage.size(), 1, [&](size_t i) { systems[stage[i]].function(world); });
+
+        world.flush();
+    }
+}
+
+} // namespace ecs
+} // namespace Tmpl8
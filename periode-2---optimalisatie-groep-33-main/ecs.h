@@ -0,0 +1,301 @@
+#pragma once
+
+namespace Tmpl8
+{
+namespace ecs
+{
+
+//Small entity-component-system:
+//- Components of one entity type (its "archetype", the exact set of component types) are stored
+//  together in fixed size chunks, one tightly packed array per component type (SoA)
+//- Systems declare which component types they read and write, the scheduler runs systems
+//  that touch disjoint components in parallel on the thread pool
+
+//Maximum amount of different component types (one bit each in a Signature)
+constexpr uint32_t max_component_types = 64;
+
+//Size of one archetype chunk in bytes, small enough to stay in L1/L2 while a system walks it
+constexpr size_t chunk_bytes = 16 * 1024;
+
+typedef uint64_t Signature;
+
+struct Entity
+{
+    uint32_t index = 0;
+    uint32_t generation = 0;
+
+    bool operator==(const Entity& other) const { return index == other.index && generation == other.generation; }
+    bool operator!=(const Entity& other) const { return !(*this == other); }
+};
+
+//Type erased information needed to store a component in a chunk
+struct ComponentInfo
+{
+    uint32_t id;
+    size_t size;
+    size_t alignment;
+    void (*move_construct)(void* destination, void* source);
+    void (*destroy)(void* component);
+};
+
+inline uint32_t next_component_id()
+{
+    static std::atomic<uint32_t> counter{0};
+    return counter++;
+}
+
+//Every component type gets an id the first time it is used
+template <class T>
+const ComponentInfo& component_info()
+{
+    typedef typename std::remove_cv<T>::type Type;
+    static const ComponentInfo info = {
+        next_component_id(),
+        sizeof(Type),
+        alignof(Type),
+        [](void* destination, void* source) { new (destination) Type(std::move(*static_cast<Type*>(source))); },
+        [](void* component) { static_cast<Type*>(component)->~Type(); }};
+    assert(info.id < max_component_types);
+    return info;
+}
+
+template <class T>
+uint32_t component_id()
+{
+    return component_info<T>().id;
+}
+
+//Signature containing all given component types, e.g. components<Smoke, Explosion>()
+template <class... Ts>
+Signature components()
+{
+    Signature signature = 0;
+    using expand = int[];
+    (void)expand{0, ((signature |= (Signature(1) << component_id<Ts>())), 0)...};
+    return signature;
+}
+
+// -----------------------------------------------------------
+// All entities with exactly the same set of component types
+// -----------------------------------------------------------
+class Archetype
+{
+  public:
+    Archetype(Signature signature, std::vector<const ComponentInfo*> infos);
+    ~Archetype();
+
+    Archetype(const Archetype&) = delete;
+    Archetype& operator=(const Archetype&) = delete;
+
+    Signature signature() const { return signature_; }
+    size_t size() const { return count; }
+
+    //Chunks stay allocated after their entities are erased, chunk_count only counts the used ones
+    size_t chunk_count() const { return (count + rows_per_chunk - 1) / rows_per_chunk; }
+    size_t chunk_size(size_t chunk) const { return std::min(rows_per_chunk, count - chunk * rows_per_chunk); }
+
+    //Start of the array of T's in the given chunk
+    template <class T>
+    T* column(size_t chunk)
+    {
+        return reinterpret_cast<T*>(chunks[chunk] + offsets[column_of[component_id<T>()]]);
+    }
+    Entity* entities(size_t chunk) { return reinterpret_cast<Entity*>(chunks[chunk]); }
+
+    //Uninitialized storage for a component of the given row
+    void* component(uint32_t id, size_t row);
+
+    //Reserve a row for a new entity, the caller constructs the components in place
+    size_t push(Entity entity);
+
+    //Remove the given rows (sorted ascending) while keeping the order of the remaining rows
+    //moved(entity, new_row) is called for every row that changed position
+    template <class F>
+    void erase(const std::vector<size_t>& rows, F&& moved);
+
+  private:
+    Entity& entity(size_t row) { return entities(row / rows_per_chunk)[row % rows_per_chunk]; }
+
+    Signature signature_;
+    std::vector<const ComponentInfo*> infos;
+    std::array<int, max_component_types> column_of;
+
+    //Chunk layout: [Entity * rows][column 0 * rows][column 1 * rows]...
+    std::vector<size_t> offsets;
+    size_t rows_per_chunk = 0;
+
+    std::vector<unsigned char*> chunks;
+    size_t count = 0;
+};
+
+template <class F>
+void Archetype::erase(const std::vector<size_t>& rows, F&& moved)
+{
+    if (rows.empty()) return;
+
+    //Destroy the removed components and shift the surviving rows down (remove erase idiom)
+    size_t next_removed = 0;
+    size_t write = rows.front();
+    for (size_t read = rows.front(); read < count; read++)
+    {
+        if (next_removed < rows.size() && rows[next_removed] == read)
+        {
+            for (const ComponentInfo* info : infos) info->destroy(component(info->id, read));
+            next_removed++;
+            continue;
+        }
+
+        for (const ComponentInfo* info : infos)
+        {
+            info->move_construct(component(info->id, write), component(info->id, read));
+            info->destroy(component(info->id, read));
+        }
+        entity(write) = entity(read);
+        moved(entity(write), write);
+        write++;
+    }
+    count = write;
+}
+
+// -----------------------------------------------------------
+// Owns all entities and their components
+// -----------------------------------------------------------
+class World
+{
+  public:
+    World() = default;
+    ~World();
+
+    World(const World&) = delete;
+    World& operator=(const World&) = delete;
+
+    //Create an entity with the given components (not thread safe, do not call from systems)
+    template <class... Ts>
+    Entity create(Ts&&... components);
+
+    //Mark an entity for destruction, it is removed at the next flush (thread safe)
+    void destroy(Entity entity);
+
+    //Apply pending destructions
+    void flush();
+
+    bool alive(Entity entity) const;
+    size_t size() const { return alive_count; }
+
+    template <class T>
+    T& get(Entity entity);
+
+    //Call fn(entity, Ts&...) for every entity that has all of the given components
+    template <class... Ts, class F>
+    void each(F&& fn);
+
+    //Call fn(count, entities, Ts*...) for every chunk containing entities with all of the given components
+    template <class... Ts, class F>
+    void each_chunk(F&& fn);
+
+  private:
+    struct Record
+    {
+        Archetype* archetype = nullptr;
+        size_t row = 0;
+        uint32_t generation = 0;
+    };
+
+    Archetype& archetype_for(Signature signature, std::vector<const ComponentInfo*> infos);
+    Entity allocate_entity();
+
+    //Archetypes in creation order so iteration is deterministic
+    std::vector<std::unique_ptr<Archetype>> archetypes;
+    std::unordered_map<Signature, Archetype*> archetype_lookup;
+
+    std::vector<Record> records;
+    std::vector<uint32_t> free_indices;
+    size_t alive_count = 0;
+
+    std::mutex destroy_mutex;
+    std::vector<Entity> pending_destroy;
+};
+
+template <class... Ts>
+Entity World::create(Ts&&... components)
+{
+    Archetype& archetype = archetype_for(ecs::components<typename std::decay<Ts>::type...>(), {&component_info<typename std::decay<Ts>::type>()...});
+
+    Entity entity = allocate_entity();
+    size_t row = archetype.push(entity);
+    records[entity.index].archetype = &archetype;
+    records[entity.index].row = row;
+
+    using expand = int[];
+    (void)expand{0, (new (archetype.component(component_id<typename std::decay<Ts>::type>(), row)) typename std::decay<Ts>::type(std::forward<Ts>(components)), 0)...};
+
+    return entity;
+}
+
+template <class T>
+T& World::get(Entity entity)
+{
+    assert(alive(entity));
+    const Record& record = records[entity.index];
+    return *static_cast<T*>(record.archetype->component(component_id<T>(), record.row));
+}
+
+template <class... Ts, class F>
+void World::each_chunk(F&& fn)
+{
+    const Signature required = ecs::components<Ts...>();
+    for (auto& archetype : archetypes)
+    {
+        if ((archetype->signature() & required) != required) continue;
+
+        for (size_t chunk = 0; chunk < archetype->chunk_count(); chunk++)
+        {
+            const size_t count = archetype->chunk_size(chunk);
+            fn(count, archetype->entities(chunk), archetype->template column<typename std::remove_cv<Ts>::type>(chunk)...);
+        }
+    }
+}
+
+template <class... Ts, class F>
+void World::each(F&& fn)
+{
+    each_chunk<Ts...>([&](size_t count, Entity* entities, Ts*... columns) {
+        for (size_t i = 0; i < count; i++) fn(entities[i], columns[i]...);
+    });
+}
+
+// -----------------------------------------------------------
+// Runs systems over the world, systems without conflicting
+// component access run in parallel
+// -----------------------------------------------------------
+class Scheduler
+{
+  public:
+    typedef std::function<void(World&)> SystemFunction;
+
+    //Systems keep their declaration order relative to every system they conflict with
+    void add_system(const char* name, Signature reads, Signature writes, SystemFunction function);
+
+    void run(World& world, ThreadPool& pool);
+
+  private:
+    struct System
+    {
+        const char* name;
+        Signature reads;
+        Signature writes;
+        SystemFunction function;
+    };
+
+    static bool conflicts(const System& a, const System& b);
+    void build_stages();
+
+    std::vector<System> systems;
+
+    //Indices into systems, every stage only contains non conflicting systems
+    std::vector<std::vector<size_t>> stages;
+    bool stages_dirty = false;
+};
+
+} // namespace ecs
+} // namespace Tmpl8
@@ -10,7 +10,7 @@ class Explosion
 
     bool done() const;
     void tick();
-    void draw(Surface* screen);
+    void draw(SpriteBatch& batch);
 
     vec2 position;
 
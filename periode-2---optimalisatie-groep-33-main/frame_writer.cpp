@@ -0,0 +1,83 @@
+#include "precomp.h"
+#include "frame_writer.h"
+
+namespace Tmpl8
+{
+
+FrameWriter::FrameWriter(std::string directory) : directory(std::move(directory))
+{
+    writer = std::thread([this] { write_frames(); });
+}
+
+FrameWriter::~FrameWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stop = true;
+    }
+    condition.notify_one();
+    writer.join();
+}
+
+//Copy the visible pixels, the surface is drawn over again while the frame is being written
+void FrameWriter::save(Surface* frame, long long frame_number)
+{
+    Frame copy;
+    copy.width = frame->get_width();
+    copy.height = frame->get_height();
+    copy.number = frame_number;
+    copy.pixels.resize((size_t)copy.width * copy.height);
+    for (int y = 0; y < copy.height; y++)
+    {
+        memcpy(copy.pixels.data() + (size_t)y * copy.width, frame->get_buffer() + y * frame->get_pitch(), copy.width * sizeof(Pixel));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queue.push_back(std::move(copy));
+    }
+    condition.notify_one();
+}
+
+void FrameWriter::write_frames()
+{
+    while (true)
+    {
+        Frame frame;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            condition.wait(lock, [this] { return stop || !queue.empty(); });
+
+            //Finish the queue before stopping
+            if (queue.empty()) return;
+
+            frame = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        write(frame);
+    }
+}
+
+void FrameWriter::write(const Frame& frame) const
+{
+    FIBITMAP* bitmap = FreeImage_Allocate(frame.width, frame.height, 32);
+
+    //FreeImage stores the bottom line first, the alpha byte is not used by the game so make it opaque
+    for (int y = 0; y < frame.height; y++)
+    {
+        Pixel* line = (Pixel*)FreeImage_GetScanLine(bitmap, frame.height - 1 - y);
+        const Pixel* source = frame.pixels.data() + (size_t)y * frame.width;
+        for (int x = 0; x < frame.width; x++) line[x] = source[x] | 0xff000000;
+    }
+
+    char file[64];
+    sprintf(file, "frame_%05lld.png", frame.number);
+    const std::string path = directory + "/" + file;
+
+    if (!FreeImage_Save(FIF_PNG, bitmap, path.c_str(), PNG_DEFAULT))
+        cout << "Could not write " << path << endl;
+    FreeImage_Unload(bitmap);
+}
+
+} // namespace Tmpl8
@@ -0,0 +1,44 @@
+#pragma once
+
+namespace Tmpl8
+{
+
+// -----------------------------------------------------------
+// Saves frames as PNG files on a background thread, the render
+// loop only pays for one copy of the pixels
+// -----------------------------------------------------------
+class FrameWriter
+{
+  public:
+    //Files are written as <directory>/frame_<number>.png, the directory has to exist
+    explicit FrameWriter(std::string directory);
+
+    //Waits until all queued frames are written
+    ~FrameWriter();
+
+    FrameWriter(const FrameWriter&) = delete;
+    FrameWriter& operator=(const FrameWriter&) = delete;
+
+    void save(Surface* frame, long long frame_number);
+
+  private:
+    struct Frame
+    {
+        std::vector<Pixel> pixels;
+        int width, height;
+        long long number;
+    };
+
+    void write_frames();
+    void write(const Frame& frame) const;
+
+    std::string directory;
+
+    std::thread writer;
+    std::mutex queue_mutex;
+    std::condition_variable condition;
+    std::deque<Frame> queue;
+    bool stop = false;
+};
+
+} // namespace Tmpl8
@@ -15,34 +15,39 @@ constexpr auto health_bar_width = 70;
 
 constexpr auto max_frames = 2000;
 
+//Routes planned per frame, tanks without a route drive straight to their destination
+constexpr auto routes_per_frame = 64;
+
+namespace Tmpl8
+{
+void NotifyUser(const char* s);
+}
+
 //Global performance timer
 constexpr auto REF_PERFORMANCE = 114757; //UPDATE THIS WITH YOUR REFERENCE PERFORMANCE (see console after 2k frames)
 static timer perf_timer;
 static float duration;
 
-//Load sprite files and initialize sprites
-static Surface* tank_red_img = new Surface("assets/Tank_Proj2.png");
-static Surface* tank_blue_img = new Surface("assets/Tank_Blue_Proj2.png");
-static Surface* rocket_red_img = new Surface("assets/Rocket_Proj2.png");
-static Surface* rocket_blue_img = new Surface("assets/Rocket_Blue_Proj2.png");
-static Surface* particle_beam_img = new Surface("assets/Particle_Beam.png");
-static Surface* smoke_img = new Surface("assets/Smoke.png");
-static Surface* explosion_img = new Surface("assets/Explosion.png");
-
-static Sprite tank_red(tank_red_img, 12);
-static Sprite tank_blue(tank_blue_img, 12);
-static Sprite rocket_red(rocket_red_img, 12);
-static Sprite rocket_blue(rocket_blue_img, 12);
-static Sprite smoke(smoke_img, 4);
-static Sprite explosion(explosion_img, 9);
-static Sprite particle_beam_sprite(particle_beam_img, 3);
-
 const static vec2 tank_size(7, 9);
 const static vec2 rocket_size(6, 6);
 
 const static float tank_radius = 3.f;
 const static float rocket_radius = 5.f;
 
+//Spawns are merged ordered by the phase that spawned them, then by the index of the spawning object
+enum spawn_phases : uint32_t
+{
+    SPAWNED_BY_ROCKETS,
+    SPAWNED_BY_FORCEFIELD,
+    SPAWNED_BY_BEAMS
+};
+
+static uint32_t spawn_key(spawn_phases phase, size_t index)
+{
+    assert(index < (1u << 24));
+    return ((uint32_t)phase << 24) | (uint32_t)index;
+}
+
 // -----------------------------------------------------------
 // Initialize the simulation state
 // This function does not count for the performance multiplier
@@ -50,9 +55,30 @@ const static float rocket_radius = 5.f;
 // -----------------------------------------------------------
 void Game::init()
 {
-    frame_count_font = new Font("assets/digital_small.png", "ABCDEFGHIJKLMNOPQRSTUVWXYZ:?!=-0123456789.");
+    //The main thread works along while it waits for the pool and the render thread draws during the update,
+    //so by default both keep a CPU of their own
+    const CpuTopology topology = CpuTopology::detect();
+    const size_t worker_count = (thread_count >= 0) ? thread_count : std::max(1, (int)topology.cpus().size() - 2);
+    thread_pool = std::make_unique<ThreadPool>(worker_count, topology, pin_threads);
+    topology.print();
+    printf("thread pool: %zu workers%s\n", worker_count, pin_threads ? ", pinned" : "");
+
+    load_sprites();
+
+    //Pack the frames of all sprites in one surface
+    for (Sprite* sprite : {tank_red.get(), tank_blue.get(), rocket_red.get(), rocket_blue.get(), smoke.get(), explosion.get(), particle_beam_sprite.get()})
+    {
+        sprite_atlas.add(sprite);
+    }
+    background_terrain.add_to_atlas(sprite_atlas);
+    sprite_atlas.build();
+
+    //The terrain is drawn once, every frame starts with a copy of it
+    background_terrain.render_background(SCRWIDTH, SCRHEIGHT);
 
     tanks.reserve(num_tanks_blue + num_tanks_red);
+    health_histograms[BLUE].reset(tank_max_health);
+    health_histograms[RED].reset(tank_max_health);
 
     uint max_rows = 24;
 
@@ -68,22 +94,92 @@ void Game::init()
     for (int i = 0; i < num_tanks_blue; i++)
     {
         vec2 position{ start_blue_x + ((i % max_rows) * spacing), start_blue_y + ((i / max_rows) * spacing) };
-        tanks.push_back(Tank(position.x, position.y, BLUE, &tank_blue, &smoke, 1100.f, position.y + 16, tank_radius, tank_max_health, tank_max_speed));
+        tanks.push_back(Tank(position.x, position.y, BLUE, tank_blue.get(), smoke.get(), 1100.f, position.y + 16, tank_radius, tank_max_health, tank_max_speed));
+        tanks.back().track_health(&health_histograms[tanks.back().allignment]);
     }
     //Spawn red tanks
     for (int i = 0; i < num_tanks_red; i++)
     {
         vec2 position{ start_red_x + ((i % max_rows) * spacing), start_red_y + ((i / max_rows) * spacing) };
-        tanks.push_back(Tank(position.x, position.y, RED, &tank_red, &smoke, 100.f, position.y + 16, tank_radius, tank_max_health, tank_max_speed));
+        tanks.push_back(Tank(position.x, position.y, RED, tank_red.get(), smoke.get(), 100.f, position.y + 16, tank_radius, tank_max_health, tank_max_speed));
+        tanks.back().track_health(&health_histograms[tanks.back().allignment]);
     }
 
-    particle_beams.push_back(Particle_beam(vec2(590, 327), vec2(100, 50), &particle_beam_sprite, particle_beam_hit_value));
-    particle_beams.push_back(Particle_beam(vec2(64, 64), vec2(100, 50), &particle_beam_sprite, particle_beam_hit_value));
-    particle_beams.push_back(Particle_beam(vec2(1200, 600), vec2(100, 50), &particle_beam_sprite, particle_beam_hit_value));
-}
+    //Plan the routes of the tanks closest to their destination first, they are the first to need one
+    for (size_t i = 0; i < tanks.size(); i++)
+    {
+        route_planner.request((uint32_t)i, tanks[i].target, (tanks[i].target - tanks[i].position).sqr_length());
+    }
 
+    particle_beams.push_back(Particle_beam(vec2(590, 327), vec2(100, 50), particle_beam_sprite.get(), particle_beam_hit_value));
+    particle_beams.push_back(Particle_beam(vec2(64, 64), vec2(100, 50), particle_beam_sprite.get(), particle_beam_hit_value));
+    particle_beams.push_back(Particle_beam(vec2(1200, 600), vec2(100, 50), particle_beam_sprite.get(), particle_beam_hit_value));
 
+    rocket_spawns.set_thread_count(thread_pool->size());
+    explosion_spawns.set_thread_count(thread_pool->size());
+    smoke_spawns.set_thread_count(thread_pool->size());
+    rocket_damage.set_thread_count(thread_pool->size());
+    beam_damage.set_thread_count(thread_pool->size());
 
+#ifdef SORT_BENCHMARK
+    sorting::benchmark(tanks, tank_max_health, *thread_pool);
+#endif
+
+#ifdef BLIT_SELFTEST
+    if (!blit_selftest()) NotifyUser("Blit selftest failed, see the console");
+#endif
+
+    build_update_graph();
+    capture_snapshot(snapshots[snapshot_index]);
+
+    //Animation systems, these touch disjoint components so the scheduler runs them in parallel
+    systems.add_system("smoke animation", 0, ecs::components<Smoke>(), [](ecs::World& world) {
+        world.each<Smoke>([](ecs::Entity, Smoke& smoke) { smoke.tick(); });
+    });
+    //Remove explosions when their animation is done
+    systems.add_system("explosion animation", 0, ecs::components<Explosion>(), [](ecs::World& world) {
+        world.each<Explosion>([&world](ecs::Entity entity, Explosion& explosion) {
+            explosion.tick();
+            if (explosion.done()) world.destroy(entity);
+        });
+    });
+}
+
+// -----------------------------------------------------------
+// Decode all sprite and tile images at the same time on the pool,
+// the font is decoded on this thread in the meantime
+// -----------------------------------------------------------
+void Game::load_sprites()
+{
+    AssetLoader loader(*thread_pool);
+    AssetLoader::SurfaceHandle tank_red_file = loader.load("assets/Tank_Proj2.png");
+    AssetLoader::SurfaceHandle tank_blue_file = loader.load("assets/Tank_Blue_Proj2.png");
+    AssetLoader::SurfaceHandle rocket_red_file = loader.load("assets/Rocket_Proj2.png");
+    AssetLoader::SurfaceHandle rocket_blue_file = loader.load("assets/Rocket_Blue_Proj2.png");
+    AssetLoader::SurfaceHandle particle_beam_file = loader.load("assets/Particle_Beam.png");
+    AssetLoader::SurfaceHandle smoke_file = loader.load("assets/Smoke.png");
+    AssetLoader::SurfaceHandle explosion_file = loader.load("assets/Explosion.png");
+
+    frame_count_font = std::make_unique<Font>("assets/digital_small.png", "ABCDEFGHIJKLMNOPQRSTUVWXYZ:?!=-0123456789.");
+
+    background_terrain.load_tiles(loader);
+
+    tank_red_img = loader.get(tank_red_file);
+    tank_blue_img = loader.get(tank_blue_file);
+    rocket_red_img = loader.get(rocket_red_file);
+    rocket_blue_img = loader.get(rocket_blue_file);
+    particle_beam_img = loader.get(particle_beam_file);
+    smoke_img = loader.get(smoke_file);
+    explosion_img = loader.get(explosion_file);
+
+    tank_red = std::make_unique<Sprite>(tank_red_img.get(), 12);
+    tank_blue = std::make_unique<Sprite>(tank_blue_img.get(), 12);
+    rocket_red = std::make_unique<Sprite>(rocket_red_img.get(), 12);
+    rocket_blue = std::make_unique<Sprite>(rocket_blue_img.get(), 12);
+    smoke = std::make_unique<Sprite>(smoke_img.get(), 4);
+    explosion = std::make_unique<Sprite>(explosion_img.get(), 9);
+    particle_beam_sprite = std::make_unique<Sprite>(particle_beam_img.get(), 3);
+}
 
 // -----------------------------------------------------------
 // Close down application
@@ -93,8 +189,6 @@ void Game::shutdown()
 
 }
 
-const unsigned int threadCount = thread::hardware_concurrency() * 2;
-
 // -----------------------------------------------------------
 // Spread Workload over all availible Threads
 // -----------------------------------------------------------
@@ -139,102 +233,143 @@ bool Tmpl8::Game::left_of_line(vec2 line_start, vec2 line_end, vec2 point)
 // Update sprite frames
 // Collision detection
 // Targeting etc..
+// The phases below run as a task graph, phases that do not touch
+// the same data run at the same time
 // -----------------------------------------------------------
 void Game::update(float deltaTime)
 {
-    //Calculate the route to the destination for each tank using BFS
-    //Initializing routes here so it gets counted for performance..
-    if (frame_count == 0)
-    {
+    update_graph.run(*thread_pool);
+}
 
-#if 0
-        //4 availible threads (Dual Core CPU)
-        if (threadCount >= 4)
-        {
-            for (int i = 0; i < tanks.size(); i += 4)
-            {
+// -----------------------------------------------------------
+// Declare the update phases in their sequential order, with the
+// data every phase reads and writes
+// -----------------------------------------------------------
+void Game::build_update_graph()
+{
+    //The route search marks the terrain tiles it visits, so it writes the terrain
+    update_graph.add_phase("routes", 0, RESOURCE_TERRAIN | RESOURCE_TANKS, [this] { plan_routes(); });
+    update_graph.add_phase("separation", 0, RESOURCE_TANKS, [this] { separate_tanks(); });
+    update_graph.add_phase("tank tick", 0, RESOURCE_TANKS, [this] { tick_tanks(); });
+    update_graph.add_phase("firing", 0, RESOURCE_TANKS | RESOURCE_ROCKETS, [this] { fire_rockets(); });
+    update_graph.add_phase("forcefield", RESOURCE_TANKS, RESOURCE_FORCEFIELD, [this] { build_forcefield(); });
+    update_graph.add_phase("rocket flight", 0, RESOURCE_ROCKETS, [this] { move_rockets(); });
+    update_graph.add_phase("rocket hits", RESOURCE_TANKS, RESOURCE_ROCKETS | RESOURCE_ROCKET_DAMAGE, [this] { hit_tanks_with_rockets(); });
+    update_graph.add_phase("rocket forcefield", RESOURCE_FORCEFIELD, RESOURCE_ROCKETS | RESOURCE_SPAWNS, [this] { stop_rockets_at_forcefield(); });
+    update_graph.add_phase("beam tick", 0, RESOURCE_BEAMS, [this] { tick_particle_beams(); });
+    update_graph.add_phase("beam hits", RESOURCE_BEAMS | RESOURCE_TANKS, RESOURCE_BEAM_DAMAGE, [this] { hit_tanks_with_beams(); });
+    update_graph.add_phase("damage", 0, RESOURCE_TANKS | RESOURCE_SPAWNS | RESOURCE_ROCKET_DAMAGE | RESOURCE_BEAM_DAMAGE, [this] { apply_damage(); });
+
+    //Update smoke and explosion sprites, done explosions are removed by the world
+    update_graph.add_phase("effect animation", 0, RESOURCE_EFFECTS, [this] { systems.run(world, *thread_pool); });
+
+    //Effects spawned this frame are added after the animation, so it does not wait for the collisions
+    update_graph.add_phase("spawn effects", 0, RESOURCE_SPAWNS | RESOURCE_EFFECTS, [this] { spawn_effects(); });
+}
 
-                //Spawn new threads and run set_route on the new thread
-                std::thread FirstPathThread([&] {
-                    tanks[i].set_route(background_terrain.get_route(tanks[i], tanks[i].target));
-                    });
+// -----------------------------------------------------------
+// Calculate the route to the destination for each tank using BFS
+// Initializing routes here so it gets counted for performance..
+// A fixed amount of requests is planned per frame (optionally less
+// within a time budget), so the routes arrive over the first frames
+// instead of all in the first
+// -----------------------------------------------------------
+void Game::plan_routes()
+{
+    if (route_planner.idle()) return;
 
-                std::thread SecondPathThread([&] {
-                    tanks[i + 1].set_route(background_terrain.get_route(tanks[i + 1], tanks[i + 1].target));
-                    });
+#if 0
+    //4 availible threads (Dual Core CPU)
+    if (threadCount >= 4)
+    {
+        for (int i = 0; i < tanks.size(); i += 4)
+        {
 
-                std::thread ThirdPathThread([&] {
-                    tanks[i + 2].set_route(background_terrain.get_route(tanks[i + 2], tanks[i + 2].target));
-                    });
+            //Spawn new threads and run set_route on the new thread
+            std::thread FirstPathThread([&] {
+                tanks[i].set_route(background_terrain.get_route(tanks[i], tanks[i].target));
+                });
 
-                //tanks.size() - 1, because otherwise the program will crash
-                if (i == tanks.size() - 1)
-                {
-                    FirstPathThread.join();
-                    SecondPathThread.join();
-                    ThirdPathThread.join();
-                    break;
-                }
+            std::thread SecondPathThread([&] {
+                tanks[i + 1].set_route(background_terrain.get_route(tanks[i + 1], tanks[i + 1].target));
+                });
 
-                //Run set_route on the main thread
-                else
-                {
-                    tanks[i + 3].set_route(background_terrain.get_route(tanks[i + 3], tanks[i + 3].target));
-                    FirstPathThread.join();
-                    SecondPathThread.join();
-                    ThirdPathThread.join();
-                }
+            std::thread ThirdPathThread([&] {
+                tanks[i + 2].set_route(background_terrain.get_route(tanks[i + 2], tanks[i + 2].target));
+                });
 
+            //tanks.size() - 1, because otherwise the program will crash
+            if (i == tanks.size() - 1)
+            {
+                FirstPathThread.join();
+                SecondPathThread.join();
+                ThirdPathThread.join();
+                break;
             }
-        }
-#endif
-        //16 threads availible (Quad Core) Not used due to race Conditions
-
-        //if (threadCount >= 16)
-        //{
-        //    std::vector<std::thread> paththreads;
-
-        //    for (int j = 0; j < tanks.size(); j+= 16)
-        //    {
-        //       
-        //        for (int k = 0; k < 16; k++)
-        //        {
-        //            paththreads.push_back(std::thread([&] {
-        //                tanks[j + k].set_route(background_terrain.get_route(tanks[j + k], tanks[j + k].target));
-        //                }));
-        //        }
-
-        //        // 4095 is de max
-        //        if (j == tanks.size() - 1)
-        //        {
-        //            for (std::thread& t : paththreads) 
-        //            {
-        //                t.join();
-        //            }
-        //            break;
-        //        }
-
-        //        //Run set_route on the main thread
-        //        else
-        //        {
-        //            tanks[j + 15].set_route(background_terrain.get_route(tanks[j + 15], tanks[j + 15].target));
-        //            for (std::thread& t : paththreads)
-        //            {
-        //                t.join();
-        //            }
-        //        }
-        //    }
-        //}
-
-
-        //Run Sequential if CPU doesn't have sufficient threads (Don't know if that's even possible...)
-            for (Tank& t : tanks)
+
+            //Run set_route on the main thread
+            else
             {
-                t.set_route(background_terrain.get_route(t, t.target));
+                tanks[i + 3].set_route(background_terrain.get_route(tanks[i + 3], tanks[i + 3].target));
+                FirstPathThread.join();
+                SecondPathThread.join();
+                ThirdPathThread.join();
             }
-    
+
+        }
     }
+#endif
+    //16 threads availible (Quad Core) Not used due to race Conditions
+
+    //if (threadCount >= 16)
+    //{
+    //    std::vector<std::thread> paththreads;
+
+    //    for (int j = 0; j < tanks.size(); j+= 16)
+    //    {
+    //       
+    //        for (int k = 0; k < 16; k++)
+    //        {
+    //            paththreads.push_back(std::thread([&] {
+    //                tanks[j + k].set_route(background_terrain.get_route(tanks[j + k], tanks[j + k].target));
+    //                }));
+    //        }
+
+    //        // 4095 is de max
+    //        if (j == tanks.size() - 1)
+    //        {
+    //            for (std::thread& t : paththreads) 
+    //            {
+    //                t.join();
+    //            }
+    //            break;
+    //        }
+
+    //        //Run set_route on the main thread
+    //        else
+    //        {
+    //            tanks[j + 15].set_route(background_terrain.get_route(tanks[j + 15], tanks[j + 15].target));
+    //            for (std::thread& t : paththreads)
+    //            {
+    //                t.join();
+    //            }
+    //        }
+    //    }
+    //}
+
+
+    //The search marks the terrain tiles it visits, so the routes are planned one after another
+    route_planner.process(routes_per_frame, route_budget, [&](uint32_t tank, vec2 destination) {
+        //Planned from where the tank drove to while it waited
+        if (tanks[tank].active) tanks[tank].set_route(background_terrain.get_route(tanks[tank], destination));
+    });
+}
 
+// -----------------------------------------------------------
+// Check tank collision and nudge tanks away from each other
+// -----------------------------------------------------------
+void Game::separate_tanks()
+{
    /*  //Old code
     for (Tank& tank : tanks)
     {
@@ -258,9 +393,9 @@ void Game::update(float deltaTime)
         }
     } */
 
-    //Check tank collision and nudge tanks away from each other
-    for (Tank& tank : tanks)
-    {
+    //Every tank only pushes itself and positions do not change here, so the tanks are independent
+    thread_pool->parallel_for(0, tanks.size(), 64, [&](size_t i) {
+        Tank& tank = tanks[i];
         if (tank.active) 
         {
             int sprite_size = 16; //Size of sprite
@@ -290,41 +425,44 @@ void Game::update(float deltaTime)
                 }
             }
         }
-    }
+    });
+}
 
+// -----------------------------------------------------------
+// Move tanks according to speed and nudges (see above) also reload
+// -----------------------------------------------------------
+void Game::tick_tanks()
+{
+    thread_pool->parallel_for(0, tanks.size(), 256, [&](size_t i) {
+        if (tanks[i].active) tanks[i].tick(background_terrain);
+    });
+}
 
-    //Update tanks
-    for (Tank& tank : tanks)
-    {
-        if (tank.active)
+// -----------------------------------------------------------
+// Shoot at the closest target of every reloaded tank
+// -----------------------------------------------------------
+void Game::fire_rockets()
+{
+    //Tanks only read each other's positions here and reload themselves, the rockets are spawned per thread
+    thread_pool->parallel_for(0, tanks.size(), 64, [&](size_t i) {
+        Tank& tank = tanks[i];
+        if (tank.active && tank.rocket_reloaded())
         {
-            //Move tanks according to speed and nudges (see above) also reload
-            tank.tick(background_terrain);
-            //Shoot at closest target if reloaded
-            if  (tank.rocket_reloaded())
-            {
-                
-                //Multi thread??
-                Tank& target = find_closest_enemy(tank);
-
-                //Since we're manipulating a vector, we lock it so other threads can't access it
-                mutex rocketLock;
-                rocketLock.lock();
-                    rockets.push_back(Rocket(tank.position, (target.get_position() - tank.position).normalized() * 3, rocket_radius, tank.allignment, ((tank.allignment == RED) ? &rocket_red : &rocket_blue)));
-                rocketLock.unlock();
-
-                tank.reload_rocket();
-            }
+            Tank& target = find_closest_enemy(tank);
+            rocket_spawns.push((uint32_t)i, Rocket(tank.position, (target.get_position() - tank.position).normalized() * 3, rocket_radius, tank.allignment, ((tank.allignment == RED) ? rocket_red.get() : rocket_blue.get())));
+            tank.reload_rocket();
         }
-    }
+    });
 
-    //Update smoke plumes
-    for (Smoke& smoke : smokes)
-    {
-        smoke.tick();
-    }
+    //Add the new rockets in tank order
+    rocket_spawns.flush([&](Rocket&& rocket) { rockets.push_back(std::move(rocket)); });
+}
 
-    //Calculate "forcefield" around active tanks
+// -----------------------------------------------------------
+// Calculate "forcefield" around active tanks
+// -----------------------------------------------------------
+void Game::build_forcefield()
+{
     forcefield_hull.clear();
 
     //Find first active tank (this loop is a bit disgusting, fix?)
@@ -337,18 +475,16 @@ void Game::update(float deltaTime)
         }
         first_active++;
     }
-    vec2 point_on_hull = tanks.at(first_active).position;
-    //Find left most tank position
-    for (Tank& tank : tanks)
-    {
-        if (tank.active)
-        {
-            if (tank.position.x <= point_on_hull.x)
-            {
-                point_on_hull = tank.position;
-            }
-        }
-    }
+
+    //Find left most tank position, on equal x the last tank wins
+    const size_t left_most = thread_pool->parallel_reduce(
+        0, tanks.size(), 1024, (size_t)first_active,
+        [](size_t i) { return i; },
+        [&](size_t a, size_t b) {
+            if (!tanks[b].active) return a;
+            return (tanks[b].position.x < tanks[a].position.x || (tanks[b].position.x == tanks[a].position.x && b > a)) ? b : a;
+        });
+    vec2 point_on_hull = tanks.at(left_most).position;
 
     //Calculate convex hull for 'rocket barrier'
     for (Tank& tank : tanks)
@@ -376,273 +512,195 @@ void Game::update(float deltaTime)
             }
         }
     }
+}
 
-    //Update rockets
-    for (Rocket& rocket : rockets)
-    {
-        rocket.tick();
+// -----------------------------------------------------------
+// Move the rockets
+// -----------------------------------------------------------
+void Game::move_rockets()
+{
+    //Rockets fly straight, so they do not depend on anything else
+    thread_pool->parallel_for(0, rockets.size(), 256, [&](size_t i) { rockets[i].tick(); });
+}
 
-        //Check if rocket collides with enemy tank, spawn explosion, and if tank is destroyed spawn a smoke plume
-        for (Tank& tank : tanks)
+// -----------------------------------------------------------
+// Check if rockets collide with enemy tanks, the damage is
+// applied afterwards in apply_damage
+// -----------------------------------------------------------
+void Game::hit_tanks_with_rockets()
+{
+    //Every rocket only disables itself and the tanks are not changed here, so the rockets are independent
+    thread_pool->parallel_for(0, rockets.size(), 64, [&](size_t rocket_index) {
+        Rocket& rocket = rockets[rocket_index];
+
+        //The first enemy tank the rocket collides with takes the hit
+        for (size_t t = 0; t < tanks.size(); t++)
         {
+            const Tank& tank = tanks[t];
             if (tank.active && (tank.allignment != rocket.allignment) && rocket.intersects(tank.position, tank.collision_radius))
             {
-                explosions.push_back(Explosion(&explosion, tank.position));
-
-                if (tank.hit(rocket_hit_value))
-                {
-                    smokes.push_back(Smoke(smoke, tank.position - vec2(7, 24)));
-                }
-
+                const uint32_t key = spawn_key(SPAWNED_BY_ROCKETS, rocket_index);
+                rocket_damage.push(key, DamageEvent{key, (uint32_t)t, rocket_hit_value, true, vec2(7, 24)});
                 rocket.active = false;
                 break;
             }
         }
-    }
+    });
+}
 
-    //Disable rockets if they collide with the "forcefield"
+// -----------------------------------------------------------
+// Disable rockets if they collide with the "forcefield"
+// -----------------------------------------------------------
+void Game::stop_rockets_at_forcefield()
+{
     //Hint: A point to convex hull intersection test might be better here? :) (Disable if outside)
-    for (Rocket& rocket : rockets)
-    {
+    //Rockets are independent here, explosions are spawned per thread
+    thread_pool->parallel_for(0, rockets.size(), 64, [&](size_t r) {
+        Rocket& rocket = rockets[r];
         if (rocket.active)
         {
             for (size_t i = 0; i < forcefield_hull.size(); i++)
             {
                 if (circle_segment_intersect(forcefield_hull.at(i), forcefield_hull.at((i + 1) % forcefield_hull.size()), rocket.position, rocket.collision_radius))
                 {
-                    explosions.push_back(Explosion(&explosion, rocket.position));
+                    explosion_spawns.push(spawn_key(SPAWNED_BY_FORCEFIELD, r), Explosion(explosion.get(), rocket.position));
                     rocket.active = false;
                 }
             }
         }
-    }
-
-
+    });
 
     //Remove exploded rockets with remove erase idiom
     rockets.erase(std::remove_if(rockets.begin(), rockets.end(), [](const Rocket& rocket) { return !rocket.active; }), rockets.end());
+}
 
-    //Update particle beams
+// -----------------------------------------------------------
+// Update particle beams
+// -----------------------------------------------------------
+void Game::tick_particle_beams()
+{
     for (Particle_beam& particle_beam : particle_beams)
     {
-        particle_beam.tick(tanks);  
-        for (Tank& tank : tanks) //Damage all tanks within the damage window of the beam (the window is an axis-aligned bounding box)
+        particle_beam.tick(tanks);
+    }
+}
+
+// -----------------------------------------------------------
+// Find the tanks within the damage window of a beam, the damage is
+// applied afterwards in apply_damage
+// -----------------------------------------------------------
+void Game::hit_tanks_with_beams()
+{
+    //The window is an axis-aligned bounding box, the hits of one tank are pushed by one thread in beam order
+    thread_pool->parallel_for(0, tanks.size(), 256, [&](size_t i) {
+        const Tank& tank = tanks[i];
+        if (!tank.active) return;
+        for (size_t b = 0; b < particle_beams.size(); b++)
         {
-            if (tank.active && particle_beam.rectangle.intersects_circle(tank.get_position(), tank.get_collision_radius()))
+            if (particle_beams[b].rectangle.intersects_circle(tank.get_position(), tank.get_collision_radius()))
             {
-                if (tank.hit(particle_beam.damage))
-                {
-                    smokes.push_back(Smoke(smoke, tank.position - vec2(0, 48)));
-                }
+                const uint32_t key = spawn_key(SPAWNED_BY_BEAMS, i);
+                beam_damage.push(key, DamageEvent{key, (uint32_t)i, particle_beams[b].damage, false, vec2(0, 48)});
             }
         }
-    }
+    });
+}
 
-    //Update explosion sprites and remove when done with remove erase idiom
-    for (Explosion& explosion : explosions)
-    {
-        explosion.tick();
-    }
+// -----------------------------------------------------------
+// Apply the hits of the collision passes: rocket hits in rocket
+// order, then beam hits in tank order. Hits on a tank destroyed
+// earlier in the frame only explode, so the outcome does not depend
+// on which thread found which hit
+// -----------------------------------------------------------
+void Game::apply_damage()
+{
+    auto apply = [&](DamageEvent&& event) {
+        Tank& tank = tanks[event.target];
+        if (event.explodes) explosion_spawns.push(event.source, Explosion(explosion.get(), tank.position));
+
+        //Hits update the shared health histograms
+        if (tank.active && tank.hit(event.amount))
+        {
+            smoke_spawns.push(event.source, Smoke(*smoke, tank.position - event.smoke_offset));
+        }
+    };
 
-    explosions.erase(std::remove_if(explosions.begin(), explosions.end(), [](const Explosion& explosion) { return explosion.done(); }), explosions.end());
+    rocket_damage.flush(apply);
+    beam_damage.flush(apply);
 }
 
 // -----------------------------------------------------------
-// Draw all sprites to the screen
-// (It is not recommended to multi-thread this function)
+// Create the effects spawned by the collision phases in the world,
+// in phase order and within a phase in order of the spawning object
 // -----------------------------------------------------------
-void Game::draw()
+void Game::spawn_effects()
 {
-    // clear the graphics window
-    screen->clear(0);
-
-    //Draw background
-    background_terrain.draw(screen);
+    explosion_spawns.flush([&](Explosion&& spawn) { world.create(std::move(spawn)); });
+    smoke_spawns.flush([&](Smoke&& spawn) { world.create(std::move(spawn)); });
+}
 
-    //Draw sprites
+// -----------------------------------------------------------
+// Record everything draw needs at the end of an update, so the
+// next update can change the game state while this is drawn
+// -----------------------------------------------------------
+void Game::capture_snapshot(RenderSnapshot& snapshot)
+{
+    //Record sprites
     for (int i = 0; i < num_tanks_blue + num_tanks_red; i++)
     {
-        tanks.at(i).draw(screen);
-
-        vec2 tank_pos = tanks.at(i).get_position();
+        tanks.at(i).draw(snapshot.sprite_batch);
     }
 
-    //Draws each rocket, smoke, partivle_beam and explosion in their corresponding list
+    //Records each rocket, smoke, partivle_beam and explosion in their corresponding list
     for (Rocket& rocket : rockets)
     {
-        rocket.draw(screen);
+        rocket.draw(snapshot.sprite_batch);
     }
 
-    for (Smoke& smoke : smokes)
-    {
-        smoke.draw(screen);
-    }
+    world.each<Smoke>([&](ecs::Entity, Smoke& smoke) { smoke.draw(snapshot.sprite_batch); });
 
     for (Particle_beam& particle_beam : particle_beams)
     {
-        particle_beam.draw(screen);
+        particle_beam.draw(snapshot.sprite_batch);
     }
 
-    for (Explosion& explosion : explosions)
-    {
-        explosion.draw(screen);
-    }
+    world.each<Explosion>([&](ecs::Entity, Explosion& explosion) { explosion.draw(snapshot.sprite_batch); });
 
-    //Draw forcefield (mostly for debugging, its kinda ugly..)
-    for (size_t i = 0; i < forcefield_hull.size(); i++)
-    {
-        vec2 line_start = forcefield_hull.at(i);
-        vec2 line_end = forcefield_hull.at((i + 1) % forcefield_hull.size());
-        line_start.x += HEALTHBAR_OFFSET;
-        line_end.x += HEALTHBAR_OFFSET;
-        screen->line(line_start, line_end, 0x0000ff);
-    }
-
-    //Draw sorted health bars
+    snapshot.forcefield_hull = forcefield_hull;
     for (int t = 0; t < 2; t++)
     {
-        const int NUM_TANKS = ((t < 1) ? num_tanks_blue : num_tanks_red);
-
-        const int begin = ((t < 1) ? 0 : num_tanks_blue);
-        std::vector<const Tank*> sorted_tanks;
-        //insertion_sort_tanks_health(tanks, sorted_tanks, begin, begin + NUM_TANKS);
-        //Merge_Sort_Tanks(tanks, sorted_tanks, begin, begin + NUM_TANKS, 0);
-        sorted_tanks.erase(std::remove_if(sorted_tanks.begin(), sorted_tanks.end(), [](const Tank* tank) { return !tank->active; }), sorted_tanks.end());
-
-        draw_health_bars(sorted_tanks, t);
+        snapshot.health_histograms[t] = health_histograms[t];
     }
 }
 
-/* // -----------------------------------------------------------
-// Sort tanks by health value using insertion sort
 // -----------------------------------------------------------
-void Tmpl8::Game::insertion_sort_tanks_health(const std::vector<Tank>& original, std::vector<const Tank*>& sorted_tanks, int begin, int end)
-{
-    const int NUM_TANKS = end - begin;
-    sorted_tanks.reserve(NUM_TANKS);
-    sorted_tanks.emplace_back(&original.at(begin));
-
-    for (int i = begin + 1; i < (begin + NUM_TANKS); i++)
-    {
-        const Tank& current_tank = original.at(i);
-
-        for (int s = (int)sorted_tanks.size() - 1; s >= 0; s--)
-        {
-            const Tank* current_checking_tank = sorted_tanks.at(s);
-
-            if ((current_checking_tank->compare_health(current_tank) <= 0))
-            {
-                sorted_tanks.insert(1 + sorted_tanks.begin() + s, &current_tank);
-                break;
-            }
-
-            if (s == 0)
-            {
-                sorted_tanks.insert(sorted_tanks.begin(), &current_tank);
-                break;
-            }
-        }
-    }
-} */
-
-// -----------------------------------------------------------
-// Merge Sort Algorithm
+// Draw a snapshot to the screen, runs on the render thread
+// Sprites are batched per layer, sorted by source frame and row and
+// rasterised per screen band on the thread pool
 // -----------------------------------------------------------
-
-void Tmpl8::Game::Merge(const std::vector<Tank>& Original_Tanks, std::vector<const Tank*>& sorted_tanks, int const left, int const mid, int const right)
+void Game::draw(RenderSnapshot& snapshot)
 {
-    auto const SubVectorA = mid - left + 1;
-    auto const SubVectorB = right - mid;
-
-    //temporary vectors
-    std::vector<Tank> LeftTanks;
-    std::vector<Tank> RightTanks;
-
-    //Copy data over from original List to the Left list or right list
-    for (int i = 0; i < SubVectorA; i++)
-    {
-        LeftTanks[i] = Original_Tanks[left + i];
-    }
-
-    for (int j = 0; j < SubVectorB; j++)
-    {
-        RightTanks[j] = Original_Tanks[mid + 1 + j];
-    }
-
-    auto IndexVectorA = 0;
-    auto IndexVectorB = 0;
-    int IndexOfMergedList = left;
-
-    // Compare Health and insert the tank back into the Original List on the correct position
-    // Based on their health
-    while (IndexVectorA < SubVectorA && IndexVectorB < SubVectorB)
-    {
-        if (LeftTanks[IndexVectorA].health <= RightTanks[IndexVectorA].health)
-        {
-            Original_Tanks[IndexOfMergedList].compare_health(LeftTanks[IndexVectorA]);
-            IndexVectorA++;
-        }
-        else
-        {
-            Original_Tanks[IndexOfMergedList].compare_health(RightTanks[IndexVectorB]);
-            IndexVectorB++;
-        }
-    }
-
-        //Copy elements of left to Original
-        while (IndexVectorA < SubVectorA)
-        {
-            Original_Tanks[IndexOfMergedList].compare_health(LeftTanks[IndexVectorA]);
-            IndexVectorA++;
-            IndexOfMergedList++;
-        }
-
-        //Copy elements of right to Original
-        while (IndexVectorB < SubVectorB)
-        {
-            Original_Tanks[IndexOfMergedList].compare_health(RightTanks[IndexVectorB]);
-            IndexVectorB++;
-            IndexOfMergedList++;
-        }
-}
+    //Draw background, this overwrites the whole screen so it does not need to be cleared first
+    background_terrain.draw(screen);
 
-//Recursive function, keep splitting until list contains one element
-void Tmpl8::Game::Merge_Sort_Tanks(const std::vector<Tank>& Original_Tanks, std::vector<const Tank*>& sorted_Tanks, int begin, int end, int depth)
-{
-    if (begin >= end)
-    {
-        return;
-    }
-   
-    auto mid = begin + (end - begin) / 2;
+    //Sort and draw all recorded sprites
+    renderer.flush(snapshot.sprite_batch, screen, *thread_pool);
 
-    //Recursive Calls (Multithreaded if 2^depth <= thread count of System)
-    if (pow(2, depth) <= threadCount) 
-    {
-        std::thread SortThread([&] {
-            Merge_Sort_Tanks(Original_Tanks, sorted_Tanks, begin, mid, depth + 1);
-            });
+    //Draw forcefield (mostly for debugging, its kinda ugly..)
+    screen->polyline(snapshot.forcefield_hull.data(), (int)snapshot.forcefield_hull.size(), 0x0000ff, vec2(HEALTHBAR_OFFSET, 0));
 
-        Merge_Sort_Tanks(Original_Tanks, sorted_Tanks, mid + 1, end, depth + 1);
-        SortThread.join();
-    }
-    
-    //Run Sequential
-    else 
+    //Draw health bars, lowest health first
+    for (int t = 0; t < 2; t++)
     {
-        
-        Merge_Sort_Tanks(Original_Tanks, sorted_Tanks, begin, mid, depth);
-        Merge_Sort_Tanks(Original_Tanks, sorted_Tanks, mid + 1, end, depth);
+        draw_health_bars(snapshot.health_histograms[t], t);
     }
-
-    //Sort the loose elements into one list again
-    Merge(Original_Tanks, sorted_Tanks, begin, mid, end);
 }
 
 // -----------------------------------------------------------
-// Draw the health bars based on the given tanks health values
+// Draw the health bars based on the health values of the given team
+// The histogram lists them in ascending order, so no sort is needed
 // -----------------------------------------------------------
-void Tmpl8::Game::draw_health_bars(const std::vector<const Tank*>& sorted_tanks, const int team)
+void Tmpl8::Game::draw_health_bars(const HealthHistogram& histogram, const int team)
 {
     int health_bar_start_x = (team < 1) ? 0 : (SCRWIDTH - HEALTHBAR_OFFSET) - 1;
     int health_bar_end_x = (team < 1) ? health_bar_width : health_bar_start_x + health_bar_width - 1;
@@ -657,18 +715,19 @@ void Tmpl8::Game::draw_health_bars(const std::vector<const Tank*>& sorted_tanks,
     }
 
     //Draw the <SCRHEIGHT> least healthy tank health bars
-    int draw_count = std::min(SCRHEIGHT, (int)sorted_tanks.size());
-    for (int i = 0; i < draw_count - 1; i++)
-    {
+    int draw_count = std::min(SCRHEIGHT, histogram.size());
+    int i = 0;
+    histogram.lowest(draw_count - 1, [&](int health) {
         //Health bars are 1 pixel each
         int health_bar_start_y = i * 1;
         int health_bar_end_y = health_bar_start_y + 1;
 
-        float health_fraction = (1 - ((double)sorted_tanks.at(i)->health / (double)tank_max_health));
+        float health_fraction = (1 - ((double)health / (double)tank_max_health));
 
         if (team == 0) { screen->bar(health_bar_start_x + (int)((double)health_bar_width * health_fraction), health_bar_start_y, health_bar_end_x, health_bar_end_y, GREENMASK); }
         else { screen->bar(health_bar_start_x, health_bar_start_y, health_bar_end_x - (int)((double)health_bar_width * health_fraction), health_bar_end_y, GREENMASK); }
-    }
+        i++;
+    });
 }
 
 // -----------------------------------------------------------
@@ -686,6 +745,8 @@ void Tmpl8::Game::measure_performance()
             duration = perf_timer.elapsed();
             cout << "Duration was: " << duration << " (Replace REF_PERFORMANCE with this value)" << endl;
             lock_update = true;
+
+            update_graph.print_critical_path();
         }
 
         frame_count--;
@@ -707,11 +768,23 @@ void Tmpl8::Game::measure_performance()
 // -----------------------------------------------------------
 void Game::tick(float deltaTime)
 {
+    //Draw the state of the previous update while updating, the screen shows the simulation one frame behind
+    RenderSnapshot& drawn = snapshots[snapshot_index];
+    render_thread.start([this, &drawn] { draw(drawn); });
+
     if (!lock_update)
     {
         update(deltaTime);
     }
-    draw();
+
+    //The other snapshot is not in use by the render thread
+    snapshot_index = 1 - snapshot_index;
+    capture_snapshot(snapshots[snapshot_index]);
+
+    render_thread.wait();
+
+    //Apply terrain changes to the cached background, the render thread is idle now
+    background_terrain.update();
 
     measure_performance();
 
@@ -8,29 +8,63 @@ class Rocket;
 class Smoke;
 class Particle_beam;
 
+//Everything draw needs, captured at the end of an update so the next update can run while it is drawn
+struct RenderSnapshot
+{
+    SpriteBatch sprite_batch;
+    std::vector<vec2> forcefield_hull;
+    HealthHistogram health_histograms[2];
+};
+
+//Damage a collision pass found, applied to the target after the pass in key order (see apply_damage)
+struct DamageEvent
+{
+    //Spawn key of the hit, the explosion and smoke of the hit are spawned with it
+    uint32_t source;
+    //Tank index
+    uint32_t target;
+    int amount;
+    //Rocket hits explode at the target
+    bool explodes;
+    //Where the smoke plume starts if the hit destroys the target, relative to the target
+    vec2 smoke_offset;
+};
+
 class Game
 {
   public:
     void set_target(Surface* surface) { screen = surface; }
+    //Worker threads of the pool (-1: one per CPU besides the main thread) and whether to pin them, call before init
+    void set_threads(int count, bool pin)
+    {
+        thread_count = count;
+        pin_threads = pin;
+    }
+    //Also stop planning routes once a frame spent this many ms on them (0: no time limit, the simulation
+    //is then the same on every run and machine), call before init
+    void set_route_budget(float ms) { route_budget = ms; }
     void init();
+    void load_sprites();
     void shutdown();
     
     //New Method
     void WorkLoadSpread();
     
     void update(float deltaTime);
-    void draw();
+    void build_update_graph();
+    void capture_snapshot(RenderSnapshot& snapshot);
+    void draw(RenderSnapshot& snapshot);
     void tick(float deltaTime);
-    void insertion_sort_tanks_health(const std::vector<Tank>& original, std::vector<const Tank*>& sorted_tanks, int begin, int end);
-
-    void Merge(const std::vector<Tank>& Original_Tanks, std::vector<const Tank*>& sorted_tanks, int const left, int const mid, int const right);
-    void Merge_Sort_Tanks(const std::vector<Tank>& Original_Tanks, std::vector<const Tank*>& sorted_Tanks, int begin, int end, int depth);
-
-    void draw_health_bars(const std::vector<const Tank*>& sorted_tanks, const int team);
+    //True once the performance measurement is done and the simulation stopped updating
+    bool finished() const { return lock_update; }
+    void draw_health_bars(const HealthHistogram& histogram, const int team);
     void measure_performance();
 
     Tank& find_closest_enemy(Tank& current_tank);
 
+    //Random numbers for one entity (e.g. a tank index) in the current frame, the same on any thread
+    RandomStream random_stream(uint32_t entity) const { return RandomStream(random_seed, entity, (uint32_t)frame_count); }
+
     void mouse_up(int button)
     { /* implement if you want to detect mouse button presses */
     }
@@ -52,24 +86,102 @@ class Game
     }
 
   private:
+    //Data the update phases read and write, one bit each
+    enum update_resources : TaskGraph::Resources
+    {
+        RESOURCE_TERRAIN = 1 << 0,
+        RESOURCE_TANKS = 1 << 1,
+        RESOURCE_ROCKETS = 1 << 2,
+        RESOURCE_FORCEFIELD = 1 << 3,
+        RESOURCE_BEAMS = 1 << 4,
+        RESOURCE_SPAWNS = 1 << 5,
+        RESOURCE_EFFECTS = 1 << 6,
+        RESOURCE_ROCKET_DAMAGE = 1 << 7,
+        RESOURCE_BEAM_DAMAGE = 1 << 8
+    };
+
+    //Update phases, see build_update_graph
+    void plan_routes();
+    void separate_tanks();
+    void tick_tanks();
+    void fire_rockets();
+    void build_forcefield();
+    void move_rockets();
+    void hit_tanks_with_rockets();
+    void stop_rockets_at_forcefield();
+    void tick_particle_beams();
+    void hit_tanks_with_beams();
+    void apply_damage();
+    void spawn_effects();
+
     Surface* screen;
 
+    std::unique_ptr<ThreadPool> thread_pool;
+    int thread_count = -1;
+    bool pin_threads = false;
+
     vector<Tank> tanks;
+    //Route requests of the tanks, planned a few per frame in plan_routes
+    RoutePlanner route_planner;
+    float route_budget = 0.f;
+    //Per team (BLUE, RED) the health of its active tanks
+    HealthHistogram health_histograms[2];
     vector<Rocket> rockets;
-    vector<Smoke> smokes;
-    vector<Explosion> explosions;
+    SpawnBuffer<Rocket> rocket_spawns;
     vector<Particle_beam> particle_beams;
 
+    //Hits of the collision passes, the passes only read the tanks so they run in parallel (and at the same time)
+    SpawnBuffer<DamageEvent> rocket_damage;
+    SpawnBuffer<DamageEvent> beam_damage;
+
+    //Smoke plumes and explosions live in the ECS world and are animated by its systems
+    ecs::World world;
+    ecs::Scheduler systems;
+
+    //Effects spawned by the collision phases and the damage, created in the world at the end of the update
+    SpawnBuffer<Explosion> explosion_spawns;
+    SpawnBuffer<Smoke> smoke_spawns;
+
+    TaskGraph update_graph;
+
+    //Source images of the sprites, their frames are copied into the atlas
+    std::unique_ptr<Surface> tank_red_img;
+    std::unique_ptr<Surface> tank_blue_img;
+    std::unique_ptr<Surface> rocket_red_img;
+    std::unique_ptr<Surface> rocket_blue_img;
+    std::unique_ptr<Surface> particle_beam_img;
+    std::unique_ptr<Surface> smoke_img;
+    std::unique_ptr<Surface> explosion_img;
+
+    std::unique_ptr<Sprite> tank_red;
+    std::unique_ptr<Sprite> tank_blue;
+    std::unique_ptr<Sprite> rocket_red;
+    std::unique_ptr<Sprite> rocket_blue;
+    std::unique_ptr<Sprite> smoke;
+    std::unique_ptr<Sprite> explosion;
+    std::unique_ptr<Sprite> particle_beam_sprite;
+
+    SpriteAtlas sprite_atlas;
+    BandRenderer renderer;
+
+    //Double buffered: the render thread draws one while the next update is captured into the other
+    RenderSnapshot snapshots[2];
+    int snapshot_index = 0;
+
     Terrain background_terrain;
     std::vector<vec2> forcefield_hull;
 
-    Font* frame_count_font;
+    std::unique_ptr<Font> frame_count_font;
     long long frame_count = 0;
+    uint32_t random_seed = 0x12345678;
 
     bool lock_update = false;
 
     //Checks if a point lies on the left of an arbitrary angled line
     bool left_of_line(vec2 line_start, vec2 line_end, vec2 point);
+
+    //Last member, so it is destroyed (and done drawing) before the state it draws
+    RenderThread render_thread;
 };
 
 }; // namespace Tmpl8
\ No newline at end of file
@@ -25,15 +25,14 @@ void Particle_beam::tick(vector<Tank>& tanks)
     }
 }
 
-void Particle_beam::draw(Surface* screen)
+void Particle_beam::draw(SpriteBatch& batch)
 {
     vec2 position = rectangle.min;
 
     const int offset_x = 23;
     const int offset_y = 137;
 
-    particle_beam_sprite->set_frame(sprite_frame / 10);
-    particle_beam_sprite->draw(screen, (int)(position.x - offset_x + HEALTHBAR_OFFSET), (int)(position.y - offset_y));
+    batch.draw(particle_beam_sprite, sprite_frame / 10, (int)(position.x - offset_x + HEALTHBAR_OFFSET), (int)(position.y - offset_y), LAYER_BEAMS);
 }
 
 } // namespace Tmpl8
\ No newline at end of file
@@ -14,6 +14,10 @@
 
 // #define FULLSCREEN
 // #define ADVANCEDGL	// faster if your system supports it
+// #define ZERO_COPY_PRESENT	// render straight into the SDL texture instead of copying every frame into it
+// #define DOUBLE_BUFFER_PRESENT	// with ZERO_COPY_PRESENT: alternate two textures, drawing overlaps presenting
+// #define SORT_BENCHMARK	// time the sorting algorithms on the tanks at startup
+// #define BLIT_SELFTEST	// check the SIMD sprite blits pixel exact against the scalar version at startup
 
 // Glew should be included first
 #include <GL/glew.h>
@@ -30,6 +34,12 @@
 
 #endif
 
+#ifdef __linux__
+// Thread affinity (pthread_setaffinity_np)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 // External dependencies:
 #include <FreeImage.h>
 
@@ -41,16 +51,21 @@
 // C++ headers
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <chrono>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <sstream>
 #include <limits>
+#include <list>
 #include <memory>
 #include <random>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include <condition_variable>
 #include <deque>
 #include <queue>
 #include <future>
@@ -60,6 +75,7 @@
 
 // Namespaced C headers:
 #include <cassert>
+#include <cstddef>
 #include <cinttypes>
 #include <cmath>
 #include <cstdio>
@@ -78,10 +94,22 @@ using namespace std;
 
 #include "template.h"
 #include "surface.h"
+#include "blit.h"
+#include "random_stream.h"
+#include "atlas.h"
 
 using namespace Tmpl8;
 
+#include "cpu_topology.h"
 #include "thread_pool.h"
+#include "asset_loader.h"
+#include "task_graph.h"
+#include "AlgorithmRepository.h"
+#include "spawn_buffer.h"
+#include "route_planner.h"
+#include "renderer.h"
+#include "frame_writer.h"
+#include "ecs.h"
 
 #include "tank.h"
 #include "terrain.h"
@@ -0,0 +1,79 @@
+#include "precomp.h"
+#include "random_stream.h"
+
+#ifdef _MSC_VER
+// MSVC allows AVX2 intrinsics in any function
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace Tmpl8
+{
+
+// -----------------------------------------------------------
+// Scalar version, defines the expected results. SSE2 has no 32
+// bit multiply (pmulld is SSE4.1), so there is no SSE2 version
+// -----------------------------------------------------------
+static void fill_uint_scalar(uint32_t* a_Dst, int a_Count, uint32_t a_Key, uint32_t a_Counter)
+{
+    for (int i = 0; i < a_Count; i++) a_Dst[i] = RandomStream::mix(a_Key ^ RandomStream::mix(a_Counter + (uint32_t)i));
+}
+
+// -----------------------------------------------------------
+// AVX2 version, hashes eight counters at a time
+// -----------------------------------------------------------
+TARGET_AVX2 static inline __m256i mix_avx2(__m256i x)
+{
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32((int)0x7feb352du));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 15));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32((int)0x846ca68bu));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+    return x;
+}
+
+TARGET_AVX2 static void fill_uint_avx2(uint32_t* a_Dst, int a_Count, uint32_t a_Key, uint32_t a_Counter)
+{
+    const __m256i key = _mm256_set1_epi32((int)a_Key);
+    const __m256i step = _mm256_set1_epi32(8);
+    __m256i counters = _mm256_add_epi32(_mm256_set1_epi32((int)a_Counter), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    int i = 0;
+    for (; i + 8 <= a_Count; i += 8)
+    {
+        _mm256_storeu_si256((__m256i*)(a_Dst + i), mix_avx2(_mm256_xor_si256(key, mix_avx2(counters))));
+        counters = _mm256_add_epi32(counters, step);
+    }
+    fill_uint_scalar(a_Dst + i, a_Count - i, a_Key, a_Counter + (uint32_t)i);
+}
+
+// -----------------------------------------------------------
+// Runtime dispatch
+// -----------------------------------------------------------
+typedef void (*FillKernel)(uint32_t*, int, uint32_t, uint32_t);
+
+static FillKernel fill_kernel()
+{
+    static const FillKernel selected = cpu_has_avx2() ? fill_uint_avx2 : fill_uint_scalar;
+    return selected;
+}
+
+void RandomStream::fill_uint(uint32_t* a_Dst, int a_Count)
+{
+    fill_kernel()(a_Dst, a_Count, key, counter);
+    counter += (uint32_t)a_Count;
+}
+
+void RandomStream::fill_float(float* a_Dst, int a_Count)
+{
+    //Small chunks on the stack, so the values are converted while they are still in L1
+    uint32_t values[64];
+    for (int i = 0; i < a_Count; i += 64)
+    {
+        const int count = std::min(64, a_Count - i);
+        fill_uint(values, count);
+        for (int j = 0; j < count; j++) a_Dst[i + j] = to_float(values[j]);
+    }
+}
+
+} // namespace Tmpl8
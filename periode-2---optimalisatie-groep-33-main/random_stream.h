@@ -0,0 +1,51 @@
+#pragma once
+
+namespace Tmpl8
+{
+
+// -----------------------------------------------------------
+// Counter based random numbers. Value n of a stream is a hash of
+// (seed, entity, frame, n), there is no shared state, so passes
+// on the thread pool get the same numbers whatever thread runs
+// which entity. Use one stream per entity per frame, e.g. the
+// tank index and frame_count.
+// -----------------------------------------------------------
+class RandomStream
+{
+  public:
+    RandomStream(uint32_t seed, uint32_t entity, uint32_t frame) : key(mix(seed ^ mix(entity ^ mix(frame + 0x9e3779b9u)))) {}
+
+    //Value a_Counter of the stream, does not advance it
+    uint32_t at(uint32_t a_Counter) const { return mix(key ^ mix(a_Counter)); }
+
+    uint32_t next_uint() { return at(counter++); }
+    //In [0, 1)
+    float next_float() { return to_float(next_uint()); }
+    //In [0, a_Range)
+    float next_float(float a_Range) { return next_float() * a_Range; }
+
+    //The next a_Count values, the same as calling next_uint a_Count times. AVX2 when the CPU has it
+    void fill_uint(uint32_t* a_Dst, int a_Count);
+    //The next a_Count values in [0, 1), the same as calling next_float a_Count times
+    void fill_float(float* a_Dst, int a_Count);
+
+    //Uses the upper 24 bits, every result is exact in a float
+    static float to_float(uint32_t a_Value) { return (a_Value >> 8) * (1.0f / 16777216.0f); }
+
+    //Bijective 32 bit hash (lowbias32), also the finalizer of the AVX2 version in random_stream.cpp
+    static uint32_t mix(uint32_t x)
+    {
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+  private:
+    uint32_t key;
+    uint32_t counter = 0;
+};
+
+} // namespace Tmpl8
@@ -0,0 +1,121 @@
+#include "precomp.h"
+#include "renderer.h"
+
+namespace Tmpl8
+{
+
+// -----------------------------------------------------------
+// SpriteBatch
+// -----------------------------------------------------------
+void SpriteBatch::draw(const Sprite* sprite, unsigned int frame, int x, int y, unsigned int layer)
+{
+    commands.push_back({sprite, frame, x, y, sprite->get_flags(), layer, sprite->get_frame(frame)});
+}
+
+void SpriteBatch::sort()
+{
+    //Frames packed in the atlas are compared by their position in it, which is the same every run
+    std::stable_sort(commands.begin(), commands.end(), [](const DrawCommand& a, const DrawCommand& b) {
+        if (a.layer != b.layer) return a.layer < b.layer;
+        if (a.source != b.source) return a.source < b.source;
+        return a.y < b.y;
+    });
+}
+
+// -----------------------------------------------------------
+// BandRenderer
+// -----------------------------------------------------------
+void BandRenderer::draw_band(const std::vector<DrawCommand>& commands, Surface* target, int band)
+{
+    const int y1 = band * band_height;
+    const int y2 = std::min(y1 + band_height, target->get_height());
+
+    for (unsigned int index : bins[band])
+    {
+        const DrawCommand& command = commands[index];
+        command.sprite->draw(target, command.x, command.y, command.frame, command.flags, y1, y2);
+    }
+}
+
+void BandRenderer::flush(SpriteBatch& batch, Surface* target, ThreadPool& pool)
+{
+    batch.sort();
+    const std::vector<DrawCommand>& commands = batch.get_commands();
+
+    const int band_count = (target->get_height() + band_height - 1) / band_height;
+    bins.resize(band_count);
+    for (std::vector<unsigned int>& bin : bins) bin.clear();
+
+    //Put every command in all bands its lines overlap
+    for (unsigned int i = 0; i < commands.size(); i++)
+    {
+        const DrawCommand& command = commands[i];
+        const int first_line = std::max(command.y, 0);
+        const int last_line = std::min(command.y + command.sprite->get_height(), target->get_height()) - 1;
+        if (last_line < first_line) continue;
+
+        for (int band = first_line / band_height; band <= last_line / band_height; band++) bins[band].push_back(i);
+    }
+
+    //Bands do not share any pixels, so they can be drawn in parallel. This runs on the render thread next to the
+    //update, which must not pick up chunks of the update passes while it waits (they push into per thread buffers)
+    pool.parallel_for_isolated(0, band_count, 1, [&](size_t band) { draw_band(commands, target, (int)band); });
+
+    batch.clear();
+}
+
+// -----------------------------------------------------------
+// Render thread
+// -----------------------------------------------------------
+RenderThread::RenderThread()
+{
+    thread = std::thread([this] { run(); });
+}
+
+RenderThread::~RenderThread()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this] { return !busy; });
+        stop = true;
+    }
+    condition.notify_all();
+    thread.join();
+}
+
+void RenderThread::start(std::function<void()> new_job)
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this] { return !busy; });
+        job = std::move(new_job);
+        busy = true;
+    }
+    condition.notify_all();
+}
+
+void RenderThread::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [this] { return !busy; });
+}
+
+void RenderThread::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        condition.wait(lock, [this] { return busy || stop; });
+        if (stop) break;
+
+        //Do not hold the lock while drawing, start and wait only need it to hand over the job
+        lock.unlock();
+        job();
+        lock.lock();
+
+        busy = false;
+        condition.notify_all();
+    }
+}
+
+} // namespace Tmpl8
@@ -0,0 +1,103 @@
+#pragma once
+
+namespace Tmpl8
+{
+
+//Layers are drawn in this order, later layers end up on top
+enum draw_layers
+{
+    LAYER_TANKS,
+    LAYER_ROCKETS,
+    LAYER_SMOKE,
+    LAYER_BEAMS,
+    LAYER_EXPLOSIONS
+};
+
+//Sprite draw recorded for later rasterisation
+struct DrawCommand
+{
+    const Sprite* sprite;
+    unsigned int frame;
+    int x, y;
+    unsigned int flags;
+    unsigned int layer;
+    //First pixel of the frame, used to group draws that read the same source image
+    const Pixel* source;
+};
+
+// -----------------------------------------------------------
+// Collects the sprite draws of a frame. Before rasterising they
+// are ordered by layer, then by source sprite and frame, then by
+// destination row, so consecutive draws read the same source
+// pixels and walk down the screen.
+// -----------------------------------------------------------
+class SpriteBatch
+{
+  public:
+    void draw(const Sprite* sprite, unsigned int frame, int x, int y, unsigned int layer);
+
+    //Stable, so draws of the same frame on the same row keep their submission order
+    void sort();
+    void clear() { commands.clear(); }
+
+    const std::vector<DrawCommand>& get_commands() const { return commands; }
+
+  private:
+    std::vector<DrawCommand> commands;
+};
+
+// -----------------------------------------------------------
+// Binned sprite renderer: the draws of a batch are sorted into
+// horizontal screen bands. Every band is drawn by one thread,
+// clipped to its own lines, in batch order, so the result is
+// identical to drawing the whole batch on one thread.
+// -----------------------------------------------------------
+class BandRenderer
+{
+  public:
+    explicit BandRenderer(int band_height = 32) : band_height(band_height) {}
+
+    //Sort the batch, rasterise it into the target and clear it
+    void flush(SpriteBatch& batch, Surface* target, ThreadPool& pool);
+
+  private:
+    void draw_band(const std::vector<DrawCommand>& commands, Surface* target, int band);
+
+    int band_height;
+
+    //Per band the indices of the commands that touch it, in batch order
+    std::vector<std::vector<unsigned int>> bins;
+};
+
+// -----------------------------------------------------------
+// Thread that runs one job at a time, it draws frame N while the
+// main thread simulates frame N + 1
+// -----------------------------------------------------------
+class RenderThread
+{
+  public:
+    RenderThread();
+    ~RenderThread();
+
+    RenderThread(const RenderThread&) = delete;
+    RenderThread& operator=(const RenderThread&) = delete;
+
+    //Run the job on the render thread, waits for the previous job first
+    void start(std::function<void()> job);
+
+    //Block until the current job is done
+    void wait();
+
+  private:
+    void run();
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable condition;
+
+    std::function<void()> job;
+    bool busy = false;
+    bool stop = false;
+};
+
+} // namespace Tmpl8
@@ -20,10 +20,10 @@ void Rocket::tick()
 }
 
 //Draw the sprite with the facing based on this rockets movement direction
-void Rocket::draw(Surface* screen)
+void Rocket::draw(SpriteBatch& batch)
 {
-    rocket_sprite->set_frame(((abs(speed.x) > abs(speed.y)) ? ((speed.x < 0) ? 3 : 0) : ((speed.y < 0) ? 9 : 6)) + (current_frame / 3));
-    rocket_sprite->draw(screen, (int)position.x - 12 + HEALTHBAR_OFFSET, (int)position.y - 12);
+    unsigned int frame = ((abs(speed.x) > abs(speed.y)) ? ((speed.x < 0) ? 3 : 0) : ((speed.y < 0) ? 9 : 6)) + (current_frame / 3);
+    batch.draw(rocket_sprite, frame, (int)position.x - 12 + HEALTHBAR_OFFSET, (int)position.y - 12, LAYER_ROCKETS);
 }
 
 //Does the given circle collide with this rockets collision circle?
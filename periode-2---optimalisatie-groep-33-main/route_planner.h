@@ -0,0 +1,70 @@
+#pragma once
+
+namespace Tmpl8
+{
+
+// -----------------------------------------------------------
+// Route requests that are planned a few at a time, so planning
+// the routes of thousands of tanks is spread over frames instead
+// of stalling the first one. Every frame process plans requests
+// in priority order (lowest value first, then request order), at
+// most a fixed amount so the frame every route arrives in is the
+// same on every run. An optional time budget stops earlier on slow
+// machines, at the cost of that determinism.
+// -----------------------------------------------------------
+class RoutePlanner
+{
+  public:
+    //Queue a route for tank <tank> to <destination>
+    void request(uint32_t tank, vec2 destination, float priority)
+    {
+        queue.push({priority, next_sequence++, tank, destination});
+    }
+
+    //Call plan(tank, destination) for at most a_MaxRequests queued requests. With a_Budget > 0 it also
+    //stops once a_Budget ms have passed, but at least one request is planned per call so the queue
+    //always drains. Returns the amount of requests planned
+    template <class F>
+    size_t process(size_t a_MaxRequests, float a_Budget, F&& plan);
+
+    size_t pending() const { return queue.size(); }
+    bool idle() const { return queue.empty(); }
+
+  private:
+    struct Request
+    {
+        float priority;
+        uint32_t sequence;
+        uint32_t tank;
+        vec2 destination;
+    };
+
+    //std::priority_queue puts the largest element on top, so "later" requests compare as smaller
+    struct Later
+    {
+        bool operator()(const Request& a, const Request& b) const
+        {
+            return (a.priority != b.priority) ? (a.priority > b.priority) : (a.sequence > b.sequence);
+        }
+    };
+
+    std::priority_queue<Request, std::vector<Request>, Later> queue;
+    uint32_t next_sequence = 0;
+};
+
+template <class F>
+size_t RoutePlanner::process(size_t a_MaxRequests, float a_Budget, F&& plan)
+{
+    timer budget_timer;
+    size_t planned = 0;
+    while (!queue.empty() && planned < a_MaxRequests && (planned == 0 || a_Budget <= 0 || budget_timer.elapsed() < a_Budget))
+    {
+        const Request request = queue.top();
+        queue.pop();
+        plan(request.tank, request.destination);
+        planned++;
+    }
+    return planned;
+}
+
+} // namespace Tmpl8
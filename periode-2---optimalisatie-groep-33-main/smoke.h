@@ -8,7 +8,7 @@ class Smoke
     Smoke(Sprite& smoke_sprite, vec2 position) : current_frame(0), smoke_sprite(smoke_sprite), position(position) {}
 
     void tick();
-    void draw(Surface* screen);
+    void draw(SpriteBatch& batch);
 
     vec2 position;
 
@@ -0,0 +1,94 @@
+#pragma once
+
+namespace Tmpl8
+{
+
+// -----------------------------------------------------------
+// Collects objects spawned by parallel passes without locking,
+// every thread of the pool appends to a buffer of its own.
+// At a sync point flush hands all spawns over in key order, so
+// the result does not depend on which thread ran which part of
+// a pass. Spawns with the same key keep the order they were
+// pushed in, as long as one thread pushes all of them.
+// Threads outside the pool (the main thread, or any thread that
+// calls run_one) get a buffer of their own the first time they
+// push, set_thread_count reserves how many of them may push.
+// -----------------------------------------------------------
+template <class T>
+class SpawnBuffer
+{
+  public:
+    //One buffer per worker plus one per thread outside the pool that pushes, call before pushing
+    void set_thread_count(size_t thread_count, size_t external_threads = 1)
+    {
+        external_count = external_threads;
+        buffers.resize(external_threads + thread_count);
+    }
+
+    //Thread safe for the workers of the pool and up to external_threads other threads
+    void push(uint32_t key, T value)
+    {
+        const int worker = ThreadPool::worker_index();
+        const size_t buffer = (worker >= 0) ? external_count + worker : external_index();
+        assert(((worker >= 0) || (buffer < external_count)) && "more threads outside the pool push than set_thread_count reserved");
+        assert(buffer < buffers.size());
+        buffers[buffer].entries.push_back({key, std::move(value)});
+    }
+
+    //Call fn(T&&) for every spawn in key order and empty the buffers, not thread safe
+    template <class F>
+    void flush(F&& fn);
+
+  private:
+    //Index of the calling thread among the threads outside the pool, in the order they first pushed
+    static size_t external_index()
+    {
+        static std::atomic<size_t> next_index{0};
+        thread_local size_t index = next_index++;
+        return index;
+    }
+
+    struct Entry
+    {
+        uint32_t key;
+        T value;
+    };
+
+    //Own cache line per buffer, so threads pushing at the same time do not share the vector headers
+    struct alignas(64) Buffer
+    {
+        std::vector<Entry> entries;
+    };
+
+    //Position of a spawn in the buffers, sorted instead of the spawns themselves
+    struct Reference
+    {
+        uint32_t key;
+        uint32_t buffer;
+        uint32_t index;
+    };
+
+    std::vector<Buffer> buffers;
+    size_t external_count = 1;
+    std::vector<Reference> order;
+};
+
+template <class T>
+template <class F>
+void SpawnBuffer<T>::flush(F&& fn)
+{
+    order.clear();
+    for (uint32_t b = 0; b < buffers.size(); b++)
+    {
+        for (uint32_t i = 0; i < buffers[b].entries.size(); i++) order.push_back({buffers[b].entries[i].key, b, i});
+    }
+
+    //Radix sort is stable, equal keys stay in buffer and push order
+    sorting::radix_sort(order.begin(), order.end(), [](const Reference& reference) { return reference.key; });
+
+    for (const Reference& reference : order) fn(std::move(buffers[reference.buffer].entries[reference.index].value));
+
+    for (Buffer& buffer : buffers) buffer.entries.clear();
+}
+
+} // namespace Tmpl8
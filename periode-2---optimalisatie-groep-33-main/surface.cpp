@@ -78,8 +78,12 @@ Surface::~Surface()
 
 void Surface::clear(Pixel a_Color)
 {
-    int s = m_Width * m_Height;
-    for (int i = 0; i < s; i++) m_Buffer[i] = a_Color;
+    // The pitch can be larger than the width when the buffer belongs to a texture
+    for (int y = 0; y < m_Height; y++)
+    {
+        Pixel* line = m_Buffer + y * m_Pitch;
+        for (int x = 0; x < m_Width; x++) line[x] = a_Color;
+    }
 }
 
 void Surface::centre(const char* a_String, int y1, Pixel color)
@@ -114,14 +118,14 @@ void Surface::print(const char* a_String, int x1, int y1, Pixel color)
 void Surface::resize(Surface* a_Orig)
 {
     Pixel *src = a_Orig->get_buffer(), *dst = m_Buffer;
-    int u, v, owidth = a_Orig->get_width(), oheight = a_Orig->get_height();
+    int u, v, owidth = a_Orig->get_width(), oheight = a_Orig->get_height(), opitch = a_Orig->get_pitch();
     int dx = (owidth << 10) / m_Width, dy = (oheight << 10) / m_Height;
     for (v = 0; v < m_Height; v++)
     {
         for (u = 0; u < m_Width; u++)
         {
             int su = u * dx, sv = v * dy;
-            Pixel* s = src + (su >> 10) + (sv >> 10) * owidth;
+            Pixel* s = src + (su >> 10) + (sv >> 10) * opitch;
             int ufrac = su & 1023, vfrac = sv & 1023;
             int w4 = (ufrac * vfrac) >> 12;
             int w3 = ((1023 - ufrac) * vfrac) >> 12;
@@ -129,7 +133,7 @@ void Surface::resize(Surface* a_Orig)
             int w1 = ((1023 - ufrac) * (1023 - vfrac)) >> 12;
             int x2 = ((su + dx) > ((owidth - 1) << 10)) ? 0 : 1;
             int y2 = ((sv + dy) > ((oheight - 1) << 10)) ? 0 : 1;
-            Pixel p1 = *s, p2 = *(s + x2), p3 = *(s + owidth * y2), p4 = *(s + owidth * y2 + x2);
+            Pixel p1 = *s, p2 = *(s + x2), p3 = *(s + opitch * y2), p4 = *(s + opitch * y2 + x2);
             unsigned int r = (((p1 & REDMASK) * w1 + (p2 & REDMASK) * w2 + (p3 & REDMASK) * w3 + (p4 & REDMASK) * w4) >> 8) & REDMASK;
             unsigned int g = (((p1 & GREENMASK) * w1 + (p2 & GREENMASK) * w2 + (p3 & GREENMASK) * w3 + (p4 & GREENMASK) * w4) >> 8) & GREENMASK;
             unsigned int b = (((p1 & BLUEMASK) * w1 + (p2 & BLUEMASK) * w2 + (p3 & BLUEMASK) * w3 + (p4 & BLUEMASK) * w4) >> 8) & BLUEMASK;
@@ -138,53 +142,74 @@ void Surface::resize(Surface* a_Orig)
     }
 }
 
-#define OUTCODE(x, y) (((x) < xmin) ? 1 : (((x) > xmax) ? 2 : 0)) + (((y) < ymin) ? 4 : (((y) > ymax) ? 8 : 0))
-
-void Surface::line(float x1, float y1, float x2, float y2, Pixel c)
+// Clip a segment to [0, a_XMax] x [0, a_YMax] (Liang-Barsky), returns false when nothing is left
+static bool clip_segment(float& x1, float& y1, float& x2, float& y2, float a_XMax, float a_YMax)
 {
-    // clip (Cohen-Sutherland, https://en.wikipedia.org/wiki/Cohen%E2%80%93Sutherland_algorithm)
-    const float xmin = 0, ymin = 0, xmax = (float)m_Width - 1, ymax = (float)m_Height - 1;
-    int c0 = OUTCODE(x1, y1), c1 = OUTCODE(x2, y2);
-    bool accept = false;
-    while (1)
+    const float dx = x2 - x1, dy = y2 - y1;
+    const float p[4] = {-dx, dx, -dy, dy};
+    const float q[4] = {x1, a_XMax - x1, y1, a_YMax - y1};
+    float t0 = 0, t1 = 1;
+    for (int i = 0; i < 4; i++)
     {
-        if (!(c0 | c1))
+        // Parallel to this edge: either completely outside or this edge does not clip
+        if (p[i] == 0)
         {
-            accept = true;
-            break;
+            if (q[i] < 0) return false;
+            continue;
         }
-        else if (c0 & c1)
-            break;
+        const float t = q[i] / p[i];
+        if (p[i] < 0)
+            t0 = std::max(t0, t);
         else
-        {
-            float x, y;
-            const int co = c0 ? c0 : c1;
-            if (co & 8)
-                x = x1 + (x2 - x1) * (ymax - y1) / (y2 - y1), y = ymax;
-            else if (co & 4)
-                x = x1 + (x2 - x1) * (ymin - y1) / (y2 - y1), y = ymin;
-            else if (co & 2)
-                y = y1 + (y2 - y1) * (xmax - x1) / (x2 - x1), x = xmax;
-            else if (co & 1)
-                y = y1 + (y2 - y1) * (xmin - x1) / (x2 - x1), x = xmin;
-            if (co == c0)
-                x1 = x, y1 = y, c0 = OUTCODE(x1, y1);
-            else
-                x2 = x, y2 = y, c1 = OUTCODE(x2, y2);
-        }
+            t1 = std::min(t1, t);
     }
-    if (!accept) return;
-    float b = x2 - x1;
-    float h = y2 - y1;
-    float l = fabsf(b);
-    if (fabsf(h) > l) l = fabsf(h);
-    int il = (int)l;
-    float dx = b / (float)l;
-    float dy = h / (float)l;
-    for (int i = 0; i <= il; i++)
+    if (t0 > t1) return false;
+    x2 = x1 + t1 * dx, y2 = y1 + t1 * dy;
+    x1 = x1 + t0 * dx, y1 = y1 + t0 * dy;
+    return true;
+}
+
+// Integer Bresenham, both end points have to be inside the surface
+void Surface::line_unclipped(int x1, int y1, int x2, int y2, Pixel c)
+{
+    int dx = abs(x2 - x1), dy = abs(y2 - y1);
+    const int sx = (x1 < x2) ? 1 : -1;
+    const int sy = (y1 < y2) ? m_Pitch : -m_Pitch;
+    // Step along the major axis, the error term decides when to step along the minor one
+    const int major = (dx >= dy) ? sx : sy, minor = (dx >= dy) ? sy : sx;
+    if (dx < dy) std::swap(dx, dy);
+    Pixel* a = m_Buffer + x1 + y1 * m_Pitch;
+    int error = dx / 2;
+    for (int i = 0; i <= dx; i++)
+    {
+        *a = c;
+        a += major;
+        error -= dy;
+        if (error < 0) a += minor, error += dx;
+    }
+}
+
+void Surface::line(float x1, float y1, float x2, float y2, Pixel c)
+{
+    const float xmax = (float)m_Width - 1, ymax = (float)m_Height - 1;
+    if (!clip_segment(x1, y1, x2, y2, xmax, ymax)) return;
+    // Clamp against rounding errors of the clipper
+    line_unclipped(std::min(std::max((int)x1, 0), m_Width - 1), std::min(std::max((int)y1, 0), m_Height - 1),
+                   std::min(std::max((int)x2, 0), m_Width - 1), std::min(std::max((int)y2, 0), m_Height - 1), c);
+}
+
+// Draw a_Count connected points, moved by a_Offset, the last point connects to the first
+void Surface::polyline(const vec2* a_Points, int a_Count, Pixel c, vec2 a_Offset)
+{
+    if (a_Count < 2) return;
+    const float xmax = (float)m_Width - 1, ymax = (float)m_Height - 1;
+    for (int i = 0; i < a_Count; i++)
     {
-        *(m_Buffer + (int)x1 + (int)y1 * m_Pitch) = c;
-        x1 += dx, y1 += dy;
+        const vec2 start = a_Points[i] + a_Offset, end = a_Points[(i + 1 == a_Count) ? 0 : i + 1] + a_Offset;
+        float x1 = start.x, y1 = start.y, x2 = end.x, y2 = end.y;
+        if (!clip_segment(x1, y1, x2, y2, xmax, ymax)) continue;
+        line_unclipped(std::min(std::max((int)x1, 0), m_Width - 1), std::min(std::max((int)y1, 0), m_Height - 1),
+                       std::min(std::max((int)x2, 0), m_Width - 1), std::min(std::max((int)y2, 0), m_Height - 1), c);
     }
 }
 
@@ -246,6 +271,25 @@ void Surface::copy_to(Surface* a_Dst, int a_X, int a_Y)
     }
 }
 
+// Copy the whole surface to the top left of a_Dst with non-temporal stores,
+// so a full screen copy does not evict the sprite data from the caches
+void Surface::stream_copy_to(Surface* a_Dst)
+{
+    const int width = std::min(m_Width, a_Dst->get_width());
+    const int height = std::min(m_Height, a_Dst->get_height());
+    for (int y = 0; y < height; y++)
+    {
+        const Pixel* src = m_Buffer + y * m_Pitch;
+        Pixel* dst = a_Dst->get_buffer() + y * a_Dst->get_pitch();
+        int x = 0;
+        // Scalar until the destination is 16 byte aligned
+        for (; (x < width) && ((uintptr_t)(dst + x) & 15); x++) dst[x] = src[x];
+        for (; x + 4 <= width; x += 4) _mm_stream_si128((__m128i*)(dst + x), _mm_loadu_si128((const __m128i*)(src + x)));
+        for (; x < width; x++) dst[x] = src[x];
+    }
+    _mm_sfence();
+}
+
 void Surface::blend_copy_to(Surface* a_Dst, int a_X, int a_Y)
 {
     Pixel* dst = a_Dst->get_buffer();
@@ -267,7 +311,7 @@ void Surface::blend_copy_to(Surface* a_Dst, int a_X, int a_Y)
             dst += a_X + dstpitch * a_Y;
             for (int y = 0; y < srcheight; y++)
             {
-                for (int x = 0; x < srcwidth; x++) dst[x] = add_blend(dst[x], src[x]);
+                blend_add_span(dst, src, srcwidth);
                 dst += dstpitch;
                 src += srcpitch;
             }
@@ -344,164 +388,225 @@ void Surface::init_charset()
 
 void Surface::scale_color(unsigned int a_Scale)
 {
-    int s = m_Pitch * m_Height;
-    for (int i = 0; i < s; i++)
-    {
-        Pixel c = m_Buffer[i];
-        unsigned int rb = (((c & (REDMASK | BLUEMASK)) * a_Scale) >> 5) & (REDMASK | BLUEMASK);
-        unsigned int g = (((c & GREENMASK) * a_Scale) >> 5) & GREENMASK;
-        m_Buffer[i] = rb + g;
-    }
+    scale_span(m_Buffer, m_Pitch * m_Height, a_Scale);
 }
 
 Sprite::Sprite(Surface* a_Surface, unsigned int a_NumFrames) : m_Width(a_Surface->get_width() / a_NumFrames),
                                                                m_Height(a_Surface->get_height()),
                                                                m_Pitch(a_Surface->get_width()),
                                                                m_NumFrames(a_NumFrames),
-                                                               m_CurrentFrame(0),
                                                                m_Flags(0),
-                                                               m_Start(new unsigned int*[a_NumFrames]),
                                                                m_Surface(a_Surface)
 {
-    initialize_start_data();
+    // Frames are stored next to each other in the source image
+    for (unsigned int f = 0; f < m_NumFrames; f++) m_FrameOffset.push_back(f * m_Width);
+    initialize_span_data();
 }
 
 Sprite::~Sprite()
 {
-    for (unsigned int i = 0; i < m_NumFrames; i++) delete m_Start[i];
-    delete m_Start;
 }
 
-void Sprite::draw(Surface* a_Target, int a_X, int a_Y)
+void Sprite::set_source(Surface* a_Surface, const std::vector<int>& a_FrameOffsets)
+{
+    // The pixels are the same, so the span data stays valid
+    m_Surface = a_Surface;
+    m_Pitch = a_Surface->get_pitch();
+    m_FrameOffset = a_FrameOffsets;
+}
+
+void Sprite::draw(Surface* a_Target, int a_X, int a_Y, unsigned int a_Frame) const
+{
+    draw(a_Target, a_X, a_Y, a_Frame, m_Flags, 0, a_Target->get_height());
+}
+
+void Sprite::draw(Surface* a_Target, int a_X, int a_Y, unsigned int a_Frame, unsigned int a_Flags, int a_ClipY1, int a_ClipY2) const
 {
     //If out of screen skip
     if ((a_X < -m_Width) || (a_X > (a_Target->get_width() + m_Width))) return;
     if ((a_Y < -m_Height) || (a_Y > (a_Target->get_height() + m_Height))) return;
 
-    //Get start and end points
-    int x1 = a_X, x2 = a_X + m_Width;
-    int y1 = a_Y, y2 = a_Y + m_Height;
+    //Get start and end points, clipped to the screen and the given lines
+    const int x1 = std::max(a_X, 0), x2 = std::min(a_X + m_Width, a_Target->get_width());
+    const int y1 = std::max(std::max(a_Y, 0), a_ClipY1), y2 = std::min(std::min(a_Y + m_Height, a_Target->get_height()), a_ClipY2);
+    if ((x2 <= x1) || (y2 <= y1)) return;
 
-    //Image start
-    Pixel* src = get_buffer() + m_CurrentFrame * m_Width;
-    //Set start x to within screen
-    if (x1 < 0)
-    {
-        src += -x1;
-        x1 = 0;
-    }
-    //Set end x to within screen
-    if (x2 > a_Target->get_width()) x2 = a_Target->get_width();
-    if (y1 < 0)
+    const Pixel* frame = get_frame(a_Frame);
+    const unsigned int* line_spans = m_LineSpans.data() + a_Frame * m_Height;
+    const int dpitch = a_Target->get_pitch();
+    Pixel* dest = a_Target->get_buffer() + y1 * dpitch;
+
+    for (int y = y1; y < y2; y++, dest += dpitch)
     {
-        src += -y1 * m_Pitch;
-        y1 = 0;
+        const int line = y - a_Y;
+        const Pixel* src = frame + line * m_Pitch;
+
+        const unsigned int first = line_spans[line], last = line_spans[line + 1];
+        if (first == last) continue;
+
+        //Lines with many short runs are blitted in one go by the colour keyed SIMD kernels
+        if (last - first > 2)
+        {
+            const int start = std::max(a_X + m_Spans[first].x, x1);
+            const int end = std::min(a_X + m_Spans[last - 1].x + m_Spans[last - 1].length, x2);
+            if (end <= start) continue;
+
+            if (a_Flags & FLARE)
+                blit_add_keyed(dest + start, src + (start - a_X), end - start);
+            else
+                blit_keyed(dest + start, src + (start - a_X), end - start);
+            continue;
+        }
+
+        //Otherwise only the opaque runs of this line are touched, no per pixel transparency test
+        for (unsigned int s = first; s < last; s++)
+        {
+            const int start = std::max(a_X + m_Spans[s].x, x1);
+            const int end = std::min(a_X + m_Spans[s].x + m_Spans[s].length, x2);
+            if (end <= start) continue;
+
+            if (a_Flags & FLARE)
+                blit_add_keyed(dest + start, src + (start - a_X), end - start);
+            else
+                memcpy(dest + start, src + (start - a_X), (end - start) * sizeof(Pixel));
+        }
     }
-    if (y2 > a_Target->get_height()) y2 = a_Target->get_height();
-    Pixel* dest = a_Target->get_buffer();
-    int xs;
+}
+
+void Sprite::draw_reference(Surface* a_Target, int a_X, int a_Y, unsigned int a_Frame, unsigned int a_Flags, int a_ClipY1, int a_ClipY2) const
+{
+    if ((a_X < -m_Width) || (a_X > (a_Target->get_width() + m_Width))) return;
+    if ((a_Y < -m_Height) || (a_Y > (a_Target->get_height() + m_Height))) return;
+
+    const int x1 = std::max(a_X, 0), x2 = std::min(a_X + m_Width, a_Target->get_width());
+    const int y1 = std::max(std::max(a_Y, 0), a_ClipY1), y2 = std::min(std::min(a_Y + m_Height, a_Target->get_height()), a_ClipY2);
+    if ((x2 <= x1) || (y2 <= y1)) return;
+
+    const Pixel* frame = get_frame(a_Frame);
+    const unsigned int* line_spans = m_LineSpans.data() + a_Frame * m_Height;
     const int dpitch = a_Target->get_pitch();
-    if ((x2 > x1) && (y2 > y1))
+    Pixel* dest = a_Target->get_buffer() + y1 * dpitch;
+
+    for (int y = y1; y < y2; y++, dest += dpitch)
     {
-        unsigned int addr = y1 * dpitch + x1;
-        const int width = x2 - x1;
-        const int height = y2 - y1;
-        for (int y = 0; y < height; y++)
+        const int line = y - a_Y;
+        const Pixel* src = frame + line * m_Pitch;
+
+        //Only the opaque runs of this line are touched, no per pixel transparency test
+        for (unsigned int s = line_spans[line]; s < line_spans[line + 1]; s++)
         {
-            const int line = y + (y1 - a_Y);
-            const int lsx = m_Start[m_CurrentFrame][line] + a_X;
-            if (m_Flags & FLARE)
+            const int start = std::max(a_X + m_Spans[s].x, x1);
+            const int end = std::min(a_X + m_Spans[s].x + m_Spans[s].length, x2);
+            if (end <= start) continue;
+
+            if (a_Flags & FLARE)
             {
-                xs = (lsx > x1) ? lsx - x1 : 0;
-                for (int x = xs; x < width; x++)
-                {
-                    const Pixel c1 = *(src + x);
-                    if (c1 & 0xffffff)
-                    {
-                        const Pixel c2 = *(dest + addr + x);
-                        *(dest + addr + x) = add_blend(c1, c2);
-                    }
-                }
+                for (int x = start; x < end; x++) dest[x] = add_blend(src[x - a_X], dest[x]);
             }
             else
             {
-                xs = (lsx > x1) ? lsx - x1 : 0;
-                for (int x = xs; x < width; x++)
-                {
-                    const Pixel c1 = *(src + x);
-                    if (c1 & 0xffffff) *(dest + addr + x) = c1;
-                }
+                memcpy(dest + start, src + (start - a_X), (end - start) * sizeof(Pixel));
             }
-            addr += dpitch;
-            src += m_Pitch;
         }
     }
 }
 
-void Sprite::draw_scaled(int a_X, int a_Y, int a_Width, int a_Height, Surface* a_Target)
+void Sprite::scale_frame(Pixel* a_Dest, int a_DestPitch, int a_Width, int a_Height, int a_X1, int a_X2, int a_Y1, int a_Y2, unsigned int a_Frame) const
 {
-    if ((a_Width == 0) || (a_Height == 0)) return;
-    if ((a_X < -a_Width) || (a_X > (a_Target->get_width() + a_Width))) return;
-    if ((a_Y < -a_Height) || (a_Y > (a_Target->get_height() + a_Height))) return;
-
-    //Get start and end points
-    int x1 = a_X;
-    int x2 = a_X + a_Width;
-    int y1 = a_Y;
-    int y2 = a_Y + a_Height;
-
-    int x_start = 0;
-    int x_end = a_Width;
-    int y_start = 0;
-    int y_end = a_Height;
-
-    //Set start x to within screen
-    if (x1 < 0)
+    // Source position x * m_Width / a_Width, stepped as a whole and a fractional part so there is no division per pixel
+    std::vector<int> columns(a_X2 - a_X1);
+    const int ustep = m_Width / a_Width, urem = m_Width % a_Width;
+    int u = (int)((long long)a_X1 * m_Width / a_Width), ufrac = (int)((long long)a_X1 * m_Width % a_Width);
+    for (int x = 0; x < a_X2 - a_X1; x++)
     {
-        x_start += -x1;
+        columns[x] = u;
+        u += ustep, ufrac += urem;
+        if (ufrac >= a_Width) u++, ufrac -= a_Width;
     }
-    //Set end x to within screen
-    if (x2 > a_Target->get_width()) x_end = a_Width - (x2 - a_Target->get_width());
-    if (y1 < 0)
+
+    const Pixel* frame = get_frame(a_Frame);
+    const int vstep = m_Height / a_Height, vrem = m_Height % a_Height;
+    int v = (int)((long long)a_Y1 * m_Height / a_Height), vfrac = (int)((long long)a_Y1 * m_Height % a_Height);
+    for (int y = a_Y1; y < a_Y2; y++)
     {
-        y_start += -y1;
+        const Pixel* src = frame + v * m_Pitch;
+        Pixel* dst = a_Dest + a_X1 + y * a_DestPitch;
+        for (int x = 0; x < a_X2 - a_X1; x++)
+        {
+            const Pixel color = src[columns[x]];
+            if (color & 0xffffff) dst[x] = color;
+        }
+        v += vstep, vfrac += vrem;
+        if (vfrac >= a_Height) v++, vfrac -= a_Height;
     }
-    if (y2 > a_Target->get_height()) y_end = a_Height - (y2 - a_Target->get_height());
+}
+
+// Scale the frame to the given size once and build its span data, nullptr when the cache is full
+const Sprite* Sprite::get_scaled(int a_Width, int a_Height, unsigned int a_Frame) const
+{
+    const uint64_t key = ((uint64_t)a_Frame << 40) | ((uint64_t)a_Width << 20) | (uint64_t)a_Height;
+    std::lock_guard<std::mutex> lock(m_ScaledMutex);
+
+    auto found = m_Scaled.find(key);
+    if (found != m_Scaled.end()) return found->second.sprite.get();
+    if (m_Scaled.size() >= s_MaxScaled) return nullptr;
+
+    ScaledFrame& scaled = m_Scaled[key];
+    scaled.surface = std::make_unique<Surface>(a_Width, a_Height);
+    scaled.surface->clear(0);
+    scale_frame(scaled.surface->get_buffer(), scaled.surface->get_pitch(), a_Width, a_Height, 0, a_Width, 0, a_Height, a_Frame);
+    scaled.sprite = std::make_unique<Sprite>(scaled.surface.get(), 1);
+    return scaled.sprite.get();
+}
+
+void Sprite::draw_scaled(int a_X, int a_Y, int a_Width, int a_Height, Surface* a_Target, unsigned int a_Frame) const
+{
+    if ((a_Width <= 0) || (a_Height <= 0)) return;
+    if ((a_X < -a_Width) || (a_X > (a_Target->get_width() + a_Width))) return;
+    if ((a_Y < -a_Height) || (a_Y > (a_Target->get_height() + a_Height))) return;
 
-    for (int x = x_start; x < x_end; x++)
+    if (m_Flags & SCALECACHE)
     {
-        for (int y = y_start; y < y_end; y++)
+        const Sprite* scaled = get_scaled(a_Width, a_Height, a_Frame);
+        if (scaled)
         {
-            int u = (int)((float)x * ((float)m_Width / (float)a_Width)) + m_CurrentFrame * m_Width;
-            int v = (int)((float)y * ((float)m_Height / (float)a_Height));
-            Pixel color = get_buffer()[u + v * m_Pitch];
-            if (color & 0xffffff)
-            {
-                a_Target->get_buffer()[a_X + x + ((a_Y + y) * a_Target->get_pitch())] = color;
-            }
+            scaled->draw(a_Target, a_X, a_Y, 0, 0, 0, a_Target->get_height());
+            return;
         }
     }
+
+    //Only scale the part that ends up on the target
+    const int x_start = std::max(0, -a_X), x_end = std::min(a_Width, a_Target->get_width() - a_X);
+    const int y_start = std::max(0, -a_Y), y_end = std::min(a_Height, a_Target->get_height() - a_Y);
+    if ((x_end <= x_start) || (y_end <= y_start)) return;
+
+    scale_frame(a_Target->get_buffer() + a_X + a_Y * a_Target->get_pitch(), a_Target->get_pitch(), a_Width, a_Height, x_start, x_end, y_start, y_end, a_Frame);
 }
 
-void Sprite::initialize_start_data()
+//Split every line of every frame in runs of opaque (non black) pixels
+void Sprite::initialize_span_data()
 {
+    m_Spans.clear();
+    m_LineSpans.clear();
+    m_LineSpans.reserve(m_NumFrames * m_Height + 1);
+
     for (unsigned int f = 0; f < m_NumFrames; ++f)
     {
-        m_Start[f] = new unsigned int[m_Height];
         for (int y = 0; y < m_Height; ++y)
         {
-            m_Start[f][y] = m_Width;
-            Pixel* addr = get_buffer() + f * m_Width + y * m_Pitch;
-            for (int x = 0; x < m_Width; ++x)
+            m_LineSpans.push_back((unsigned int)m_Spans.size());
+            const Pixel* addr = get_frame(f) + y * m_Pitch;
+            int x = 0;
+            while (x < m_Width)
             {
-                if (addr[x])
-                {
-                    m_Start[f][y] = x;
-                    break;
-                }
+                while ((x < m_Width) && !(addr[x] & 0xffffff)) x++;
+                const int start = x;
+                while ((x < m_Width) && (addr[x] & 0xffffff)) x++;
+                if (x > start) m_Spans.push_back({(unsigned short)start, (unsigned short)(x - start)});
             }
         }
     }
+    m_LineSpans.push_back((unsigned int)m_Spans.size());
 }
 
 Font::Font(const char* a_File, const char* a_Chars)
@@ -510,13 +615,14 @@ Font::Font(const char* a_File, const char* a_Chars)
     Pixel* b = m_Surface->get_buffer();
     int w = m_Surface->get_width();
     int h = m_Surface->get_height();
+    const unsigned int chars = (unsigned int)strlen(a_Chars);
     unsigned int charnr = 0, start = 0;
     m_Trans = new int[256];
     memset(m_Trans, 0, 1024);
     unsigned int i;
-    for (i = 0; i < strlen(a_Chars); i++) m_Trans[(unsigned char)a_Chars[i]] = i;
-    m_Offset = new int[strlen(a_Chars)];
-    m_Width = new int[strlen(a_Chars)];
+    for (i = 0; i < chars; i++) m_Trans[(unsigned char)a_Chars[i]] = i;
+    m_Offset = new int[chars];
+    m_Width = new int[chars];
     m_Height = h;
     m_CY1 = 0, m_CY2 = 1024;
     int x, y;
@@ -534,27 +640,44 @@ Font::Font(const char* a_File, const char* a_Chars)
         {
             m_Width[charnr] = x - start;
             m_Offset[charnr] = start;
-            if (++charnr == strlen(a_Chars)) break;
+            if (++charnr == chars) break;
         }
         lastempty = empty;
     }
+    // Glyphs missing from the image are empty
+    for (; charnr < chars; charnr++) m_Width[charnr] = m_Offset[charnr] = 0;
+
+    // Opaque extent of every glyph line, so text runs only blit the part that has pixels
+    m_GlyphLines.resize(chars * h);
+    for (i = 0; i < chars; i++)
+    {
+        for (y = 0; y < h; y++)
+        {
+            const Pixel* line = b + m_Offset[i] + y * w;
+            Extent extent = {m_Width[i], 0};
+            for (x = 0; x < m_Width[i]; x++)
+            {
+                if (line[x] & 0xffffff) extent.x1 = std::min(extent.x1, x), extent.x2 = x + 1;
+            }
+            m_GlyphLines[i * h + y] = extent;
+        }
+    }
 }
 
 Font::~Font()
 {
     delete m_Surface;
-    delete m_Trans;
-    delete m_Width;
-    delete m_Offset;
+    delete[] m_Trans;
+    delete[] m_Width;
+    delete[] m_Offset;
 }
 
 int Font::width(const char* a_Text)
 {
     int w = 0;
-    unsigned int i;
-    for (i = 0; i < strlen(a_Text); i++)
+    for (const char* t = a_Text; *t; t++)
     {
-        unsigned char c = (unsigned char)a_Text[i];
+        unsigned char c = (unsigned char)*t;
         if (c == 32)
             w += 4;
         else
@@ -565,51 +688,110 @@ int Font::width(const char* a_Text)
 
 void Font::centre(Surface* a_Target, const char* a_Text, int a_Y)
 {
-    int x = (a_Target->get_pitch() - width(a_Text)) / 2;
+    int x = (a_Target->get_width() - width(a_Text)) / 2;
     print(a_Target, a_Text, x, a_Y);
 }
 
-void Font::print(Surface* a_Target, const char* a_Text, int a_X, int a_Y, bool clip)
+// Render a string into a run the second time it is printed, later prints of the same string reuse it
+const Font::TextRun* Font::get_run(const std::string& a_Text)
 {
-    Pixel* b = a_Target->get_buffer() + a_X + a_Y * a_Target->get_pitch();
-    Pixel* s = m_Surface->get_buffer();
-    unsigned int i, cx;
-    int x, y;
-    if (((a_Y + m_Height) < m_CY1) || (a_Y > m_CY2)) return;
-    for (cx = 0, i = 0; i < strlen(a_Text); i++)
+    auto found = m_Runs.find(a_Text);
+    if (found != m_Runs.end())
+    {
+        m_RunOrder.splice(m_RunOrder.begin(), m_RunOrder, found->second.order);
+        return &found->second.run;
+    }
+
+    //Strings printed only once (like a frame counter) are not worth rendering into a run
+    const size_t hash = std::hash<std::string>()(a_Text);
+    size_t& seen = m_Seen[hash % s_SeenSlots];
+    if (seen != hash)
     {
-        if (a_Text[i] == ' ')
+        seen = hash;
+        return nullptr;
+    }
+
+    if (m_Runs.size() >= s_MaxRuns)
+    {
+        m_Runs.erase(m_RunOrder.back());
+        m_RunOrder.pop_back();
+    }
+    m_RunOrder.push_front(a_Text);
+    CachedRun& cached = m_Runs[a_Text];
+    cached.order = m_RunOrder.begin();
+
+    TextRun& run = cached.run;
+    run.width = width(a_Text.c_str());
+    run.pixels.assign(run.width * m_Height, 0);
+    run.lines.assign(m_Height, Extent{run.width, 0});
+
+    const int spitch = m_Surface->get_pitch();
+    int cx = 0;
+    for (const char* t = a_Text.c_str(); *t; t++)
+    {
+        if (*t == ' ')
+        {
             cx += 4;
-        else
+            continue;
+        }
+        const int c = m_Trans[(unsigned char)*t];
+        for (int y = 0; y < m_Height; y++)
         {
-            int c = m_Trans[(unsigned char)a_Text[i]];
-            Pixel *t = s + m_Offset[c], *d = b + cx;
-            if (clip)
-            {
-                for (y = 0; y < m_Height; y++)
-                {
-                    if (((a_Y + y) >= m_CY1) && ((a_Y + y) <= m_CY2))
-                    {
-                        for (x = 0; x < m_Width[c]; x++)
-                            if ((t[x]) && ((x + (int)cx + a_X) < a_Target->get_pitch()))
-                                d[x] = add_blend(t[x], d[x]);
-                    }
-                    t += m_Surface->get_pitch(), d += a_Target->get_pitch();
-                }
-            }
-            else
-            {
-                for (y = 0; y < m_Height; y++)
-                {
-                    if (((a_Y + y) >= m_CY1) && ((a_Y + y) <= m_CY2))
-                        for (x = 0; x < m_Width[c]; x++)
-                            if (t[x]) d[x] = add_blend(t[x], d[x]);
-                    t += m_Surface->get_pitch(), d += a_Target->get_pitch();
-                }
-            }
-            cx += m_Width[c] + 2;
-            if ((int)(cx + a_X) >= a_Target->get_pitch()) break;
+            const Extent& glyph = m_GlyphLines[c * m_Height + y];
+            if (glyph.x2 <= glyph.x1) continue;
+            memcpy(run.pixels.data() + y * run.width + cx + glyph.x1, m_Surface->get_buffer() + m_Offset[c] + glyph.x1 + y * spitch, (glyph.x2 - glyph.x1) * sizeof(Pixel));
+            run.lines[y].x1 = std::min(run.lines[y].x1, cx + glyph.x1);
+            run.lines[y].x2 = std::max(run.lines[y].x2, cx + glyph.x2);
         }
+        cx += m_Width[c] + 2;
+    }
+    return &run;
+}
+
+// Lines a_Y1 up to and including a_Y2 of the text at (a_X, a_Y), one add blit per glyph line
+void Font::print_glyphs(Surface* a_Target, const char* a_Text, int a_X, int a_Y1, int a_Y2, int a_Y)
+{
+    const int spitch = m_Surface->get_pitch(), dpitch = a_Target->get_pitch();
+    int cx = a_X;
+    for (const char* t = a_Text; *t; t++)
+    {
+        if (*t == ' ')
+        {
+            cx += 4;
+            continue;
+        }
+        const int c = m_Trans[(unsigned char)*t];
+        for (int y = a_Y1; y <= a_Y2; y++)
+        {
+            const Extent& glyph = m_GlyphLines[c * m_Height + (y - a_Y)];
+            const int x1 = std::max(cx + glyph.x1, 0), x2 = std::min(cx + glyph.x2, a_Target->get_width());
+            if (x2 <= x1) continue;
+            blit_add_keyed(a_Target->get_buffer() + y * dpitch + x1, m_Surface->get_buffer() + m_Offset[c] + (x1 - cx) + (y - a_Y) * spitch, x2 - x1);
+        }
+        cx += m_Width[c] + 2;
+    }
+}
+
+void Font::print(Surface* a_Target, const char* a_Text, int a_X, int a_Y)
+{
+    const int y1 = std::max(std::max(a_Y, m_CY1), 0);
+    const int y2 = std::min(std::min(a_Y + m_Height - 1, m_CY2), a_Target->get_height() - 1);
+    if (y2 < y1) return;
+
+    const TextRun* run = get_run(a_Text);
+    if (!run)
+    {
+        print_glyphs(a_Target, a_Text, a_X, y1, y2, a_Y);
+        return;
+    }
+
+    const int dpitch = a_Target->get_pitch();
+    for (int y = y1; y <= y2; y++)
+    {
+        const Extent& line = run->lines[y - a_Y];
+        const int x1 = std::max(a_X + line.x1, 0), x2 = std::min(a_X + line.x2, a_Target->get_width());
+        if (x2 <= x1) continue;
+        blit_add_keyed(a_Target->get_buffer() + y * dpitch + x1, run->pixels.data() + (y - a_Y) * run->width + (x1 - a_X), x2 - x1);
     }
 }
 
@@ -59,8 +59,8 @@ class Surface
     // member data access
     Pixel* get_buffer() { return m_Buffer; }
     void set_buffer(Pixel* a_Buffer) { m_Buffer = a_Buffer; }
-    int get_width() { return m_Width; }
-    int get_height() { return m_Height; }
+    int get_width() const { return m_Width; }
+    int get_height() const { return m_Height; }
     int get_pitch() { return m_Pitch; }
     void set_pitch(int a_Pitch) { m_Pitch = a_Pitch; }
     // Special operations
@@ -71,9 +71,11 @@ class Surface
     void clear(Pixel a_Color);
     void line(float x1, float y1, float x2, float y2, Pixel color);
     void line(vec2 start, vec2 end, Pixel color);
+    void polyline(const vec2* a_Points, int a_Count, Pixel color, vec2 a_Offset = vec2(0, 0));
     void plot(int x, int y, Pixel c);
     void load_image(const char* a_File);
     void copy_to(Surface* a_Dst, int a_X, int a_Y);
+    void stream_copy_to(Surface* a_Dst);
     void blend_copy_to(Surface* a_Dst, int a_X, int a_Y);
     void scale_color(unsigned int a_Scale);
     void box(int x1, int y1, int x2, int y2, Pixel color);
@@ -81,6 +83,8 @@ class Surface
     void resize(Surface* a_Orig);
 
   private:
+    void line_unclipped(int x1, int y1, int x2, int y2, Pixel color);
+
     // Attributes
     Pixel* m_Buffer;
     int m_Width, m_Height;
@@ -107,33 +111,68 @@ class Sprite
         BRIGHTEST = (1 << 9),
         RFLARE = (1 << 12),
         GFLARE = (1 << 13),
-        NOCLIP = (1 << 14)
+        NOCLIP = (1 << 14),
+        SCALECACHE = (1 << 15) // draw_scaled keeps the frames it scaled, per requested size
     };
 
     // Structors
     Sprite(Surface* a_Surface, unsigned int a_NumFrames);
     ~Sprite();
     // Methods
-    void draw(Surface* a_Target, int a_X, int a_Y);
-    void draw_scaled(int a_X, int a_Y, int a_Width, int a_Height, Surface* a_Target);
+    void draw(Surface* a_Target, int a_X, int a_Y, unsigned int a_Frame = 0) const;
+    // Draw a frame with the given flags, only touching lines a_ClipY1 up to (not including) a_ClipY2
+    void draw(Surface* a_Target, int a_X, int a_Y, unsigned int a_Frame, unsigned int a_Flags, int a_ClipY1, int a_ClipY2) const;
+    // Scalar version of draw without the SIMD kernels, the results draw has to match (see blit_selftest)
+    void draw_reference(Surface* a_Target, int a_X, int a_Y, unsigned int a_Frame, unsigned int a_Flags, int a_ClipY1, int a_ClipY2) const;
+    void draw_scaled(int a_X, int a_Y, int a_Width, int a_Height, Surface* a_Target, unsigned int a_Frame = 0) const;
     void set_flags(unsigned int a_Flags) { m_Flags = a_Flags; }
-    void set_frame(unsigned int a_Index) { m_CurrentFrame = a_Index; }
     unsigned int get_flags() const { return m_Flags; }
-    int get_width() { return m_Width; }
-    int get_height() { return m_Height; }
+    int get_width() const { return m_Width; }
+    int get_height() const { return m_Height; }
     Pixel* get_buffer() { return m_Surface->get_buffer(); }
-    unsigned int frames() { return m_NumFrames; }
+    // Top left pixel of a frame
+    Pixel* get_frame(unsigned int a_Index) const { return m_Surface->get_buffer() + m_FrameOffset[a_Index]; }
+    unsigned int frames() const { return m_NumFrames; }
     Surface* get_surface() { return m_Surface; }
-    void initialize_start_data();
+    // Read the frames from another surface (e.g. an atlas), frame f starts at pixel a_FrameOffsets[f]
+    void set_source(Surface* a_Surface, const std::vector<int>& a_FrameOffsets);
+    void initialize_span_data();
 
   private:
+    // Run of opaque pixels on one line of a frame
+    struct Span
+    {
+        unsigned short x, length;
+    };
+
+    // A frame scaled to one requested size, drawn like an unscaled sprite
+    struct ScaledFrame
+    {
+        std::unique_ptr<Surface> surface;
+        std::unique_ptr<Sprite> sprite;
+    };
+
+    // Nearest neighbour scaling of rows a_Y1..a_Y2 and columns a_X1..a_X2 of the frame scaled to a_Width x a_Height,
+    // scaled pixel (x, y) goes to a_Dest[x + y * a_DestPitch]
+    void scale_frame(Pixel* a_Dest, int a_DestPitch, int a_Width, int a_Height, int a_X1, int a_X2, int a_Y1, int a_Y2, unsigned int a_Frame) const;
+    const Sprite* get_scaled(int a_Width, int a_Height, unsigned int a_Frame) const;
+
+    // At most this many scaled frames are kept per sprite, other sizes are scaled while drawing
+    static const size_t s_MaxScaled = 16;
+
     // Attributes
     int m_Width, m_Height, m_Pitch;
     unsigned int m_NumFrames;
-    unsigned int m_CurrentFrame;
     unsigned int m_Flags;
-    unsigned int** m_Start;
+    // Opaque runs of all frames in one table, the runs of line y of frame f are
+    // m_Spans[m_LineSpans[f * m_Height + y]] up to m_Spans[m_LineSpans[f * m_Height + y + 1]]
+    std::vector<Span> m_Spans;
+    std::vector<unsigned int> m_LineSpans;
+    std::vector<int> m_FrameOffset;
     Surface* m_Surface;
+    // Scaled frames by (frame, width, height), entries are never removed so drawing threads can keep using them
+    mutable std::unordered_map<uint64_t, ScaledFrame> m_Scaled;
+    mutable std::mutex m_ScaledMutex;
 };
 
 class Font
@@ -142,7 +181,8 @@ class Font
     Font(){};
     Font(const char* a_File, const char* a_Chars);
     ~Font();
-    void print(Surface* a_Target, const char* a_Text, int a_X, int a_Y, bool clip = false);
+    // Text is always clipped to the target and to the lines set with y_clip
+    void print(Surface* a_Target, const char* a_Text, int a_X, int a_Y);
     void centre(Surface* a_Target, const char* a_Text, int a_Y);
     int width(const char* a_Text);
     int height() { return m_Surface->get_height(); }
@@ -153,6 +193,36 @@ class Font
     }
 
   private:
+    // Opaque part of one line of a glyph or text run, x1 up to (not including) x2
+    struct Extent
+    {
+        int x1, x2;
+    };
+
+    // A string rendered once with all its glyphs next to each other, printed with one add blit per line
+    struct TextRun
+    {
+        int width;
+        std::vector<Pixel> pixels;
+        std::vector<Extent> lines;
+    };
+
+    struct CachedRun
+    {
+        TextRun run;
+        std::list<std::string>::iterator order;
+    };
+
+    // The run of a string that is printed repeatedly, null the first time a string is seen
+    const TextRun* get_run(const std::string& a_Text);
+    // Blit the glyphs of a string one by one, for strings that are not cached (e.g. a new frame counter every frame)
+    void print_glyphs(Surface* a_Target, const char* a_Text, int a_X, int a_Y1, int a_Y2, int a_Y);
+
+    // At most this many strings are cached, the least recently printed one is evicted
+    static const size_t s_MaxRuns = 64;
+    // Hashes of recently printed strings, a string gets a run when it is printed again while its hash is still here
+    static const size_t s_SeenSlots = 64;
+
     Surface* m_Surface = nullptr;
     int* m_Offset = nullptr;
     int* m_Width = nullptr;
@@ -160,6 +230,12 @@ class Font
     int m_Height = 0;
     int m_CY1 = 0;
     int m_CY2 = 0;
+    // Opaque extent of line y of glyph c is m_GlyphLines[c * m_Height + y]
+    std::vector<Extent> m_GlyphLines;
+    std::unordered_map<std::string, CachedRun> m_Runs;
+    // Cached strings, most recently printed first
+    std::list<std::string> m_RunOrder;
+    std::array<size_t, s_SeenSlots> m_Seen = {};
 };
 
 }; // namespace Tmpl8
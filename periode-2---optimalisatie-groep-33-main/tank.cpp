@@ -28,7 +28,8 @@ Tank::Tank(
       active(true),
       current_frame(0),
       tank_sprite(tank_sprite),
-      smoke_sprite(smoke_sprite)
+      smoke_sprite(smoke_sprite),
+      health_histogram(nullptr)
 {
 }
 
@@ -92,15 +93,27 @@ void Tank::reload_rocket()
     reload_time = 200.0f;
 }
 
+void Tank::track_health(HealthHistogram* histogram)
+{
+    health_histogram = histogram;
+    if (active) health_histogram->add(health);
+}
+
+//Destroyed tanks no longer have a health bar
 void Tank::deactivate()
 {
+    if (active && health_histogram) health_histogram->remove(health);
     active = false;
 }
 
 //Remove health
 bool Tank::hit(int hit_value)
 {
+    //Only active tanks are counted in the histogram
+    const bool tracked = active && health_histogram;
+    if (tracked) health_histogram->remove(health);
     health -= hit_value;
+    if (tracked) health_histogram->add(health);
 
     if (health <= 0)
     {
@@ -112,11 +125,11 @@ bool Tank::hit(int hit_value)
 }
 
 //Draw the sprite with the facing based on this tanks movement direction
-void Tank::draw(Surface* screen)
+void Tank::draw(SpriteBatch& batch)
 {
     vec2 direction = (target - position).normalized();
-    tank_sprite->set_frame(((abs(direction.x) > abs(direction.y)) ? ((direction.x < 0) ? 3 : 0) : ((direction.y < 0) ? 9 : 6)) + (current_frame / 3));
-    tank_sprite->draw(screen, (int)position.x - 7 + HEALTHBAR_OFFSET, (int)position.y - 9);
+    unsigned int frame = ((abs(direction.x) > abs(direction.y)) ? ((direction.x < 0) ? 3 : 0) : ((direction.y < 0) ? 9 : 6)) + (current_frame / 3);
+    batch.draw(tank_sprite, frame, (int)position.x - 7 + HEALTHBAR_OFFSET, (int)position.y - 9, LAYER_TANKS);
 }
 
 int Tank::compare_health(const Tank& other) const
@@ -10,6 +10,51 @@ enum allignments
     RED
 };
 
+// -----------------------------------------------------------
+// Amount of active tanks per health value of one team, kept up to
+// date by the tanks themselves so the lowest health values can be
+// listed without sorting
+// -----------------------------------------------------------
+class HealthHistogram
+{
+  public:
+    void reset(int max_health)
+    {
+        counts.assign(max_health + 1, 0);
+        total = 0;
+    }
+
+    void add(int health)
+    {
+        counts[clamp_health(health)]++;
+        total++;
+    }
+    void remove(int health)
+    {
+        counts[clamp_health(health)]--;
+        total--;
+    }
+
+    //Amount of tanks in the histogram
+    int size() const { return total; }
+
+    //Call fn(health) for the <count> lowest health values in ascending order (prefix walk over the counts)
+    template <class F>
+    void lowest(int count, F&& fn) const
+    {
+        for (int health = 0; health < (int)counts.size() && count > 0; health++)
+        {
+            for (int i = std::min(counts[health], count); i > 0; i--, count--) fn(health);
+        }
+    }
+
+  private:
+    int clamp_health(int health) const { return std::max(0, std::min(health, (int)counts.size() - 1)); }
+
+    std::vector<int> counts;
+    int total = 0;
+};
+
 class Tank
 {
   public:
@@ -26,10 +71,13 @@ class Tank
     void set_route(const std::vector<vec2>& route);
     void reload_rocket();
 
+    //Register this tank in the histogram of its team, which is updated on every hit
+    void track_health(HealthHistogram* histogram);
+
     void deactivate();
     bool hit(int hit_value);
 
-    void draw(Surface* screen);
+    void draw(SpriteBatch& batch);
 
     int compare_health(const Tank& other) const;
 
@@ -58,6 +106,8 @@ class Tank
     Sprite* tank_sprite;
     Sprite* smoke_sprite;
 
+    HealthHistogram* health_histogram;
+
 };
 
 } // namespace Tmpl8
\ No newline at end of file
@@ -0,0 +1,135 @@
+#include "precomp.h"
+#include "task_graph.h"
+
+namespace Tmpl8
+{
+
+void TaskGraph::add_phase(const char* name, Resources reads, Resources writes, PhaseFunction function)
+{
+    Phase phase;
+    phase.name = name;
+    phase.reads = reads;
+    phase.writes = writes;
+    phase.function = std::move(function);
+    phases.push_back(std::move(phase));
+    dirty = true;
+}
+
+bool TaskGraph::conflicts(const Phase& a, const Phase& b)
+{
+    return (a.writes & (b.reads | b.writes)) || (b.writes & a.reads);
+}
+
+//Every phase depends on all earlier phases it conflicts with, declaration order is a topological order
+void TaskGraph::build()
+{
+    for (size_t i = 0; i < phases.size(); i++)
+    {
+        phases[i].dependencies.clear();
+        phases[i].dependants.clear();
+        for (size_t j = 0; j < i; j++)
+        {
+            if (conflicts(phases[i], phases[j]))
+            {
+                phases[i].dependencies.push_back(j);
+                phases[j].dependants.push_back(i);
+            }
+        }
+    }
+
+    std::vector<std::atomic<size_t>>(phases.size()).swap(waiting);
+    dirty = false;
+}
+
+void TaskGraph::run(ThreadPool& pool)
+{
+    if (dirty) build();
+    if (phases.empty()) return;
+
+    timer run_timer;
+
+    for (size_t i = 0; i < phases.size(); i++) waiting[i].store(phases[i].dependencies.size(), std::memory_order_relaxed);
+    remaining.store(phases.size());
+
+    for (size_t i = 0; i < phases.size(); i++)
+    {
+        if (phases[i].dependencies.empty()) pool.submit([this, &pool, i] { execute(pool, i); });
+    }
+
+    //Help running phases until all of them are done
+    while (remaining.load(std::memory_order_acquire) > 0)
+    {
+        if (!pool.run_one()) _mm_pause();
+    }
+
+    run_ms = run_timer.elapsed();
+    find_critical_path();
+}
+
+void TaskGraph::execute(ThreadPool& pool, size_t phase)
+{
+    while (true)
+    {
+        timer phase_timer;
+        phases[phase].function();
+        phases[phase].time = phase_timer.elapsed();
+
+        //Start the dependants that are now ready, the first one continues on this thread
+        size_t next = phases.size();
+        for (size_t dependant : phases[phase].dependants)
+        {
+            if (waiting[dependant].fetch_sub(1, std::memory_order_acq_rel) != 1) continue;
+
+            if (next == phases.size())
+                next = dependant;
+            else
+                pool.submit([this, &pool, dependant] { execute(pool, dependant); });
+        }
+
+        //After the last phase finishes run() may return, so the graph must not be touched after the decrement
+        const bool more = next != phases.size();
+        remaining.fetch_sub(1, std::memory_order_release);
+        if (!more) return;
+        phase = next;
+    }
+}
+
+//Longest path through the dependency graph, weighted by the phase times of the last run
+void TaskGraph::find_critical_path()
+{
+    std::vector<float> finish(phases.size(), 0.f);
+    std::vector<size_t> previous(phases.size(), phases.size());
+
+    size_t last = 0;
+    for (size_t i = 0; i < phases.size(); i++)
+    {
+        float start = 0.f;
+        for (size_t dependency : phases[i].dependencies)
+        {
+            if (finish[dependency] > start)
+            {
+                start = finish[dependency];
+                previous[i] = dependency;
+            }
+        }
+        finish[i] = start + phases[i].time;
+        if (finish[i] > finish[last]) last = i;
+    }
+
+    critical_path_phases.clear();
+    for (size_t i = last; i < phases.size(); i = previous[i]) critical_path_phases.push_back(i);
+    std::reverse(critical_path_phases.begin(), critical_path_phases.end());
+    critical_path_ms = finish[last];
+}
+
+void TaskGraph::print_critical_path() const
+{
+    cout << "Critical path (" << critical_path_ms << " of " << run_ms << " ms):";
+    for (size_t i = 0; i < critical_path_phases.size(); i++)
+    {
+        cout << (i ? " -> " : " ") << phases[critical_path_phases[i]].name << " " << phases[critical_path_phases[i]].time << "ms";
+    }
+    cout << endl;
+}
+
+} // namespace Tmpl8
@@ -0,0 +1,73 @@
+#pragma once
+
+namespace Tmpl8
+{
+
+// -----------------------------------------------------------
+// Per frame task graph: phases declare the resources they read
+// and write (one bit each), a phase depends on every earlier
+// phase it conflicts with. Running the graph starts every phase
+// on the thread pool as soon as its dependencies are done, so
+// independent phases overlap.
+// The time of every phase is measured, which gives the critical
+// path: the chain of dependent phases that bounds the frame time.
+// -----------------------------------------------------------
+class TaskGraph
+{
+  public:
+    typedef uint64_t Resources;
+    typedef std::function<void()> PhaseFunction;
+
+    //Phases keep their declaration order relative to every phase they conflict with
+    void add_phase(const char* name, Resources reads, Resources writes, PhaseFunction function);
+
+    //Run all phases and return once they are done, the calling thread works along
+    void run(ThreadPool& pool);
+
+    size_t size() const { return phases.size(); }
+    const char* phase_name(size_t phase) const { return phases[phase].name; }
+
+    //Time in ms the phase took in the last run
+    float phase_time(size_t phase) const { return phases[phase].time; }
+
+    //Phases on the longest chain of dependent phases in the last run, in execution order
+    const std::vector<size_t>& critical_path() const { return critical_path_phases; }
+    float critical_path_time() const { return critical_path_ms; }
+
+    //Time in ms of the whole last run
+    float run_time() const { return run_ms; }
+
+    //Print the critical path of the last run to the console
+    void print_critical_path() const;
+
+  private:
+    struct Phase
+    {
+        const char* name;
+        Resources reads;
+        Resources writes;
+        PhaseFunction function;
+
+        std::vector<size_t> dependencies;
+        std::vector<size_t> dependants;
+        float time = 0.f;
+    };
+
+    static bool conflicts(const Phase& a, const Phase& b);
+    void build();
+    void execute(ThreadPool& pool, size_t phase);
+    void find_critical_path();
+
+    std::vector<Phase> phases;
+    bool dirty = false;
+
+    //Per phase, the dependencies that still have to finish in the current run
+    std::vector<std::atomic<size_t>> waiting;
+    std::atomic<size_t> remaining{0};
+
+    std::vector<size_t> critical_path_phases;
+    float critical_path_ms = 0.f;
+    float run_ms = 0.f;
+};
+
+} // namespace Tmpl8
@@ -125,6 +125,33 @@ Surface* surface = 0;
 Game* game = 0;
 SDL_Window* window = 0;
 
+#if defined(ZERO_COPY_PRESENT) && !defined(ADVANCEDGL)
+
+#ifdef DOUBLE_BUFFER_PRESENT
+const int presentBuffers = 2;
+#else
+const int presentBuffers = 1;
+#endif
+
+// Point the surface at the memory of a locked streaming texture, the game renders into it directly
+void lockFrame(SDL_Texture* a_Texture, Surface* a_Surface)
+{
+    void* target = 0;
+    int pitch;
+    if (SDL_LockTexture(a_Texture, NULL, &target, &pitch) != 0)
+    {
+        // Without the texture memory the game would draw through a null buffer
+        char t[256];
+        snprintf(t, sizeof(t), "Could not lock the frame texture: %s", SDL_GetError());
+        NotifyUser(t);
+        return;
+    }
+    a_Surface->set_buffer((Pixel*)target);
+    a_Surface->set_pitch(pitch / (int)sizeof(Pixel));
+}
+
+#endif
+
 #ifdef ADVANCEDGL
 
 bool createFBtexture()
@@ -216,9 +243,145 @@ void swap()
 
 #endif
 
+// Command line options for running without a window, e.g. on servers:
+// --headless               render into an offscreen surface, SDL video is not initialised
+// --frames <n>             stop after n frames (default: when the game reports it is finished)
+// --dump <f1,f2,...>       save these frames as PNG files
+// --dump-dir <directory>   where the PNG files go (default: current directory)
+// --thread-sweep           headless benchmark: run the game with 1, 2, 4, ... threads up to one per CPU
+// Thread options, windowed and headless:
+// --threads <n>            worker threads besides the main thread (default: one per CPU minus one)
+// --pin                    pin every worker to its own CPU, spread over the L3/NUMA domains
+// --route-budget <ms>      also limit route planning per frame to this many ms (default: 2 in a window,
+//                          0 = only the fixed amount of routes per frame when headless, so runs are repeatable)
+struct CommandLineOptions
+{
+    bool headless = false;
+    long long frames = -1;
+    std::vector<long long> dumpFrames;
+    std::string dumpDirectory = ".";
+    bool threadSweep = false;
+    int threads = -1;
+    bool pin = false;
+    float routeBudget = -1.f;
+};
+
+CommandLineOptions parseArguments(int argc, char** argv)
+{
+    CommandLineOptions options;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string argument = argv[i];
+        const bool hasValue = (i + 1 < argc);
+        if (argument == "--headless")
+            options.headless = true;
+        else if (argument == "--frames" && hasValue)
+            options.frames = atoll(argv[++i]);
+        else if (argument == "--dump" && hasValue)
+        {
+            std::stringstream list(argv[++i]);
+            std::string frame;
+            while (std::getline(list, frame, ',')) options.dumpFrames.push_back(atoll(frame.c_str()));
+        }
+        else if (argument == "--dump-dir" && hasValue)
+            options.dumpDirectory = argv[++i];
+        else if (argument == "--thread-sweep")
+            options.headless = options.threadSweep = true;
+        else if (argument == "--threads" && hasValue)
+            options.threads = atoi(argv[++i]);
+        else if (argument == "--pin")
+            options.pin = true;
+        else if (argument == "--route-budget" && hasValue)
+            options.routeBudget = (float)atof(argv[++i]);
+        else
+            printf("unknown argument: %s\n", argv[i]);
+    }
+    std::sort(options.dumpFrames.begin(), options.dumpFrames.end());
+    return options;
+}
+
+int runHeadless(const CommandLineOptions& options)
+{
+    surface = new Surface(SCRWIDTH, SCRHEIGHT);
+    surface->clear(0);
+    game = new Game();
+    game->set_target(surface);
+    game->set_threads(options.threads, options.pin);
+    game->set_route_budget(std::max(options.routeBudget, 0.f));
+    game->init();
+
+    long long frame = 0;
+    {
+        FrameWriter writer(options.dumpDirectory);
+        size_t nextDump = 0;
+        timer total, t;
+        while (!game->finished() && (options.frames < 0 || frame < options.frames))
+        {
+            game->tick(t.elapsed());
+            t.reset();
+            frame++;
+
+            while (nextDump < options.dumpFrames.size() && options.dumpFrames[nextDump] < frame) nextDump++;
+            if (nextDump < options.dumpFrames.size() && options.dumpFrames[nextDump] == frame) writer.save(surface, frame);
+        }
+        printf("headless: %lld frames in %.1f ms (%.3f ms per frame)\n", frame, total.elapsed(), total.elapsed() / std::max(frame, 1ll));
+        // The writer finishes the queued frames here
+    }
+
+    game->shutdown();
+    return 0;
+}
+
+// Run a fresh game for every thread count and print the time per frame
+// Every game is deleted before the next one starts, so its workers do not compete with the next run
+int runThreadSweep(const CommandLineOptions& options)
+{
+    const int cpus = (int)CpuTopology::detect().cpus().size();
+    std::vector<int> threadCounts;
+    for (int threads = 1; threads < cpus; threads *= 2) threadCounts.push_back(threads);
+    threadCounts.push_back(cpus);
+
+    std::vector<double> frameTimes;
+    for (int threads : threadCounts)
+    {
+        surface = new Surface(SCRWIDTH, SCRHEIGHT);
+        surface->clear(0);
+        game = new Game();
+        game->set_target(surface);
+        // The main thread is one of the threads
+        game->set_threads(threads - 1, options.pin);
+        game->set_route_budget(std::max(options.routeBudget, 0.f));
+        game->init();
+
+        long long frame = 0;
+        timer total, t;
+        while (!game->finished() && (options.frames < 0 || frame < options.frames))
+        {
+            game->tick(t.elapsed());
+            t.reset();
+            frame++;
+        }
+        frameTimes.push_back(total.elapsed() / std::max(frame, 1ll));
+        game->shutdown();
+
+        delete game;
+        game = 0;
+        delete surface;
+        surface = 0;
+    }
+
+    printf("threads  ms/frame  speedup\n");
+    for (size_t i = 0; i < threadCounts.size(); i++) printf("%7d  %8.3f  %7.2f\n", threadCounts[i], frameTimes[i], frameTimes[0] / frameTimes[i]);
+    return 0;
+}
+
 int main(int argc, char** argv)
 {
     printf("application started.\n");
+    const CommandLineOptions options = parseArguments(argc, argv);
+    if (options.threadSweep) return runThreadSweep(options);
+    if (options.headless) return runHeadless(options);
+
     SDL_Init(SDL_INIT_VIDEO);
 
 #ifdef ADVANCEDGL
@@ -236,14 +399,28 @@ int main(int argc, char** argv)
 #else
     window = SDL_CreateWindow(TEMPLATE_VERSION, 100, 100, SCRWIDTH, SCRHEIGHT, SDL_WINDOW_SHOWN);
 #endif
+    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED /* | SDL_RENDERER_PRESENTVSYNC*/);
+#ifdef ZERO_COPY_PRESENT
+    // The surface does not own any memory, every frame it wraps the locked texture
+    // With DOUBLE_BUFFER_PRESENT the textures alternate, so the renderer can still be
+    // presenting the previous frame while the next one is drawn into the other texture
+    SDL_Texture* frameBuffers[presentBuffers];
+    for (int i = 0; i < presentBuffers; i++) frameBuffers[i] = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, SCRWIDTH, SCRHEIGHT);
+    int frameIndex = 0;
+    surface = new Surface(SCRWIDTH, SCRHEIGHT, 0, SCRWIDTH);
+    lockFrame(frameBuffers[frameIndex], surface);
+    surface->clear(0);
+#else
     surface = new Surface(SCRWIDTH, SCRHEIGHT);
     surface->clear(0);
-    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED /* | SDL_RENDERER_PRESENTVSYNC*/);
     SDL_Texture* frameBuffer = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, SCRWIDTH, SCRHEIGHT);
+#endif
 #endif
     int exitapp = 0;
     game = new Game();
     game->set_target(surface);
+    game->set_threads(options.threads, options.pin);
+    game->set_route_budget((options.routeBudget < 0) ? 2.f : options.routeBudget);
     timer t;
     t.reset();
     while (!exitapp)
@@ -251,6 +428,13 @@ int main(int argc, char** argv)
 #ifdef ADVANCEDGL
         swap();
         surface->SetBuffer((Pixel*)framedata);
+#elif defined(ZERO_COPY_PRESENT)
+        // Present the frame that was rendered into the locked texture, then lock the next one
+        SDL_UnlockTexture(frameBuffers[frameIndex]);
+        SDL_RenderCopy(renderer, frameBuffers[frameIndex], NULL, NULL);
+        SDL_RenderPresent(renderer);
+        frameIndex = (frameIndex + 1) % presentBuffers;
+        lockFrame(frameBuffers[frameIndex], surface);
 #else
         void* target = 0;
         int pitch;
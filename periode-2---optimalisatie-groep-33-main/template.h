@@ -17,7 +17,8 @@ typedef unsigned int uint;
 #define FREE64(x) _aligned_free(x)
 #else
 #define ALIGN(x) __attribute__((aligned(x)))
-#define MALLOC64(x) aligned_alloc(64, x)
+// aligned_alloc requires the size to be a multiple of the alignment
+#define MALLOC64(x) aligned_alloc(64, ((size_t)(x) + 63) & ~(size_t)63)
 #define FREE64(x) free(x)
 #define __inline __attribute__((__always_inline__))
 #endif
@@ -41,8 +42,9 @@ typedef unsigned int uint;
 #define unlikely(expr) __builtin_expect((expr), false)
 #endif
 
-// deterministic rng
-static uint seed = 0x12345678;
+// deterministic rng, per thread so it is not shared between workers
+// parallel passes should use RandomStream, these numbers depend on what ran on the thread before
+static thread_local uint seed = 0x12345678;
 inline uint random_uint()
 {
     seed ^= seed << 13;
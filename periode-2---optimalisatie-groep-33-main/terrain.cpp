@@ -10,21 +10,6 @@ namespace Tmpl8
 {
     Terrain::Terrain()
     {
-        //Load in terrain sprites
-        grass_img = std::make_unique<Surface>("assets/tile_grass.png");
-        forest_img = std::make_unique<Surface>("assets/tile_forest.png");
-        rocks_img = std::make_unique<Surface>("assets/tile_rocks.png");
-        mountains_img = std::make_unique<Surface>("assets/tile_mountains.png");
-        water_img = std::make_unique<Surface>("assets/tile_water.png");
-
-
-        tile_grass = std::make_unique<Sprite>(grass_img.get(), 1);
-        tile_forest = std::make_unique<Sprite>(forest_img.get(), 1);
-        tile_rocks = std::make_unique<Sprite>(rocks_img.get(), 1);
-        tile_water = std::make_unique<Sprite>(water_img.get(), 1);
-        tile_mountains = std::make_unique<Sprite>(mountains_img.get(), 1);
-
-
         //Load terrain layout file and fill grid based on tiletypes
         fs::path terrain_file_path{ "assets/terrain.txt" };
         std::ifstream terrain_file(terrain_file_path);
@@ -98,46 +83,111 @@ namespace Tmpl8
         }
     }
 
+    void Terrain::load_tiles(AssetLoader& loader)
+    {
+        //Request all tile images before waiting for the first one, so they are decoded at the same time
+        AssetLoader::SurfaceHandle grass = loader.load("assets/tile_grass.png");
+        AssetLoader::SurfaceHandle forest = loader.load("assets/tile_forest.png");
+        AssetLoader::SurfaceHandle rocks = loader.load("assets/tile_rocks.png");
+        AssetLoader::SurfaceHandle mountains = loader.load("assets/tile_mountains.png");
+        AssetLoader::SurfaceHandle water = loader.load("assets/tile_water.png");
+
+        grass_img = loader.get(grass);
+        forest_img = loader.get(forest);
+        rocks_img = loader.get(rocks);
+        mountains_img = loader.get(mountains);
+        water_img = loader.get(water);
+
+        tile_grass = std::make_unique<Sprite>(grass_img.get(), 1);
+        tile_forest = std::make_unique<Sprite>(forest_img.get(), 1);
+        tile_rocks = std::make_unique<Sprite>(rocks_img.get(), 1);
+        tile_water = std::make_unique<Sprite>(water_img.get(), 1);
+        tile_mountains = std::make_unique<Sprite>(mountains_img.get(), 1);
+    }
+
     void Terrain::update()
     {
         //Pretend there is animation code here.. next year :)
+
+        //Redraw changed tiles into the cached background
+        if (background)
+        {
+            for (const auto& tile : invalidated_tiles)
+            {
+                int posX = (tile.first * sprite_size) + HEALTHBAR_OFFSET;
+                int posY = tile.second * sprite_size;
+                background->bar(posX, posY, posX + sprite_size - 1, posY + sprite_size - 1, 0);
+                draw_tile(background.get(), tile.first, tile.second);
+            }
+        }
+        invalidated_tiles.clear();
     }
 
-    void Terrain::draw(Surface* target) const
+    void Terrain::invalidate_tile(size_t x, size_t y)
     {
+        invalidated_tiles.emplace_back(x, y);
+    }
+
+    void Terrain::add_to_atlas(SpriteAtlas& atlas)
+    {
+        atlas.add(tile_grass.get());
+        atlas.add(tile_forest.get());
+        atlas.add(tile_rocks.get());
+        atlas.add(tile_mountains.get());
+        atlas.add(tile_water.get());
+    }
+
+    void Terrain::render_background(int width, int height)
+    {
+        background = std::make_unique<Surface>(width, height);
+        background->clear(0);
+
         //for tile on the vertical axis
         for (size_t y = 0; y < tiles.size(); y++)
         {
             //for tile on the horizontal axis
             for (size_t x = 0; x < tiles.at(y).size(); x++)
             {
-                int posX = (x * sprite_size) + HEALTHBAR_OFFSET;
-                int posY = y * sprite_size;
-                
-                //for tiles at (x, y) draw the tile using recursion
-                switch (tiles.at(y).at(x).tile_type)
-                {
-                case TileType::GRASS:
-                    tile_grass->draw(target, posX, posY);
-                    break;
-                case TileType::FORREST:
-                    tile_forest->draw(target, posX, posY);
-                    break;
-                case TileType::ROCKS:
-                    tile_rocks->draw(target, posX, posY);
-                    break;
-                case TileType::MOUNTAINS:
-                    tile_mountains->draw(target, posX, posY);
-                    break;
-                case TileType::WATER:
-                    tile_water->draw(target, posX, posY);
-                    break;
-                default:
-                    tile_grass->draw(target, posX, posY);
-                    break;
-                }
+                draw_tile(background.get(), x, y);
             }
         }
+        invalidated_tiles.clear();
+    }
+
+    //Replaces the whole target with the terrain (including the empty border around it)
+    void Terrain::draw(Surface* target) const
+    {
+        assert(background);
+        background->stream_copy_to(target);
+    }
+
+    void Terrain::draw_tile(Surface* target, size_t x, size_t y) const
+    {
+        int posX = (x * sprite_size) + HEALTHBAR_OFFSET;
+        int posY = y * sprite_size;
+
+        //for tiles at (x, y) draw the sprite of its tile type
+        switch (tiles.at(y).at(x).tile_type)
+        {
+        case TileType::GRASS:
+            tile_grass->draw(target, posX, posY);
+            break;
+        case TileType::FORREST:
+            tile_forest->draw(target, posX, posY);
+            break;
+        case TileType::ROCKS:
+            tile_rocks->draw(target, posX, posY);
+            break;
+        case TileType::MOUNTAINS:
+            tile_mountains->draw(target, posX, posY);
+            break;
+        case TileType::WATER:
+            tile_water->draw(target, posX, posY);
+            break;
+        default:
+            tile_grass->draw(target, posX, posY);
+            break;
+        }
     }
 
     
@@ -35,9 +35,21 @@ namespace Tmpl8
 
         Terrain();
 
+        //Decode the tile images, call before using the terrain sprites
+        void load_tiles(AssetLoader& loader);
+
         void update();
         void draw(Surface* target) const;
 
+        //Register the tile sprites so they get packed with the other sprites
+        void add_to_atlas(SpriteAtlas& atlas);
+
+        //Render all tiles once into a cached background of the given (screen) size
+        void render_background(int width, int height);
+
+        //Mark a tile as changed, it is redrawn into the background at the next update
+        void invalidate_tile(size_t x, size_t y);
+
         //Use Breadth-first search to find shortest route to the destination
         vector<vec2> get_route(const Tank& tank, const vec2& target);
 
@@ -53,6 +65,8 @@ namespace Tmpl8
 
         bool is_accessible(int y, int x);
 
+        void draw_tile(Surface* target, size_t x, size_t y) const;
+
         static constexpr int sprite_size = 16;
         static constexpr size_t terrain_width = 80;
         static constexpr size_t terrain_height = 45;
@@ -70,5 +84,9 @@ namespace Tmpl8
         std::unique_ptr<Sprite> tile_water;
 
         std::array<std::array<TerrainTile, terrain_width>, terrain_height> tiles;
+
+        //Pre-rendered terrain, copied to the screen every frame instead of drawing all tiles
+        std::unique_ptr<Surface> background;
+        std::vector<std::pair<size_t, size_t>> invalidated_tiles;
     };
 }
\ No newline at end of file
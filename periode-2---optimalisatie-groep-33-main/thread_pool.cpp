@@ -0,0 +1,265 @@
+#include "precomp.h"
+#include "thread_pool.h"
+
+namespace Tmpl8
+{
+
+//Set on the worker threads, so tasks scheduled from inside a task go to the worker's own deque
+static thread_local ThreadPool* current_pool = nullptr;
+static thread_local int current_worker = -1;
+
+//Workers allocate from a ring owned by their pool, it has to outlive tasks that finish on other workers
+static thread_local TaskRing* current_ring = nullptr;
+
+// -----------------------------------------------------------
+// Task
+// -----------------------------------------------------------
+Task* TaskRing::allocate()
+{
+    //A few tries is enough, a slot that is still in use after a full lap is a long running task
+    constexpr int tries = 8;
+    for (int i = 0; i < tries; i++)
+    {
+        Task& task = tasks[next++ & (size - 1)];
+        if (!task.in_use.load(std::memory_order_acquire))
+        {
+            task.in_use.store(true, std::memory_order_relaxed);
+            task.from_heap = false;
+            return &task;
+        }
+    }
+
+    //Ring is full, fall back to the heap
+    Task* task = new Task();
+    task->from_heap = true;
+    return task;
+}
+
+Task* Task::allocate()
+{
+    if (current_ring) return current_ring->allocate();
+
+    //Threads outside of any pool (the main thread) have a ring of their own
+    static thread_local TaskRing ring;
+    return ring.allocate();
+}
+
+void Task::release(Task* task)
+{
+    if (task->from_heap)
+        delete task;
+    else
+        task->in_use.store(false, std::memory_order_release);
+}
+
+// -----------------------------------------------------------
+// Work stealing deque
+// -----------------------------------------------------------
+bool WorkStealingDeque::push(Task* task)
+{
+    const int64_t b = bottom.load(std::memory_order_relaxed);
+    const int64_t t = top.load(std::memory_order_acquire);
+    if (b - t >= capacity) return false;
+
+    //Release/acquire on the slot publishes the task contents to the thread that takes it
+    buffer[b & (capacity - 1)].store(task, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return true;
+}
+
+Task* WorkStealingDeque::pop()
+{
+    const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+
+    if (t > b)
+    {
+        //Empty
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    Task* task = buffer[b & (capacity - 1)].load(std::memory_order_acquire);
+    if (t == b)
+    {
+        //Last task, race the stealers for it
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) task = nullptr;
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return task;
+}
+
+Task* WorkStealingDeque::steal()
+{
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t b = bottom.load(std::memory_order_acquire);
+    if (t >= b) return nullptr;
+
+    Task* task = buffer[t & (capacity - 1)].load(std::memory_order_acquire);
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) return nullptr;
+    return task;
+}
+
+// -----------------------------------------------------------
+// Thread pool
+// -----------------------------------------------------------
+ThreadPool::ThreadPool(size_t numThreads)
+{
+    start(numThreads, std::vector<int>(numThreads, 0));
+}
+
+ThreadPool::ThreadPool(size_t numThreads, const CpuTopology& topology, bool pin)
+{
+    const std::vector<CpuTopology::Cpu> placement = topology.placement(numThreads);
+
+    std::vector<int> domains;
+    for (const CpuTopology::Cpu& cpu : placement) domains.push_back(cpu.domain);
+    start(numThreads, domains);
+
+    if (pin)
+    {
+        for (size_t i = 0; i < workers.size(); ++i)
+        {
+            if (!pin_thread(workers[i], placement[i].id)) printf("could not pin worker %zu to cpu %d\n", i, placement[i].id);
+        }
+    }
+}
+
+void ThreadPool::start(size_t numThreads, const std::vector<int>& domains)
+{
+    for (size_t i = 0; i < numThreads; ++i)
+    {
+        deques.push_back(std::make_unique<WorkStealingDeque>());
+        rings.push_back(std::make_unique<TaskRing>());
+    }
+
+    //Steal close by first: the workers of the same domain starting after this one, then the other domains
+    victims.resize(numThreads + 1);
+    for (size_t i = 0; i < numThreads; ++i)
+    {
+        for (int same_domain = 1; same_domain >= 0; same_domain--)
+        {
+            for (size_t offset = 1; offset < numThreads; offset++)
+            {
+                const size_t victim = (i + offset) % numThreads;
+                if ((domains[victim] == domains[i]) == (same_domain == 1)) victims[i].push_back(victim);
+            }
+        }
+    }
+    for (size_t i = 0; i < numThreads; ++i) victims[numThreads].push_back(i);
+
+    //Start the workers after all deques exist, they steal from each other right away
+    for (size_t i = 0; i < numThreads; ++i)
+        workers.push_back(std::thread([this, i] { work(i); }));
+}
+
+ThreadPool::~ThreadPool()
+{
+    //Workers finish all queued tasks before they exit
+    {
+        std::lock_guard<std::mutex> lock(park_mutex);
+        stop = true;
+    }
+    park.notify_all();
+
+    for (auto& thread : workers)
+        thread.join();
+}
+
+int ThreadPool::worker_index()
+{
+    return current_worker;
+}
+
+void ThreadPool::schedule(Task* task)
+{
+    //Count the task before it becomes visible, a worker that sees it then never parks with work queued
+    pending.fetch_add(1);
+
+    if (current_pool != this || !deques[current_worker]->push(task))
+    {
+        std::lock_guard<std::mutex> lock(injection_mutex);
+        injection.push_back(task);
+    }
+
+    if (sleeping.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(park_mutex);
+        park.notify_one();
+    }
+}
+
+//Own deque first, then the injection queue, then steal from the other workers
+Task* ThreadPool::take(int worker)
+{
+    Task* task = nullptr;
+    if (worker >= 0) task = deques[worker]->pop();
+
+    if (!task && pending.load(std::memory_order_relaxed) > 0)
+    {
+        std::lock_guard<std::mutex> lock(injection_mutex);
+        if (!injection.empty())
+        {
+            task = injection.front();
+            injection.pop_front();
+        }
+    }
+
+    const std::vector<size_t>& order = victims[worker >= 0 ? worker : deques.size()];
+    for (size_t i = 0; !task && i < order.size() && pending.load(std::memory_order_relaxed) > 0; i++)
+    {
+        task = deques[order[i]]->steal();
+    }
+
+    if (task) pending.fetch_sub(1, std::memory_order_relaxed);
+    return task;
+}
+
+bool ThreadPool::run_one()
+{
+    Task* task = take(current_pool == this ? current_worker : -1);
+    if (!task) return false;
+
+    task->run();
+    return true;
+}
+
+void ThreadPool::work(size_t index)
+{
+    current_pool = this;
+    current_worker = (int)index;
+    current_ring = rings[index].get();
+
+    while (true)
+    {
+        if (Task* task = take((int)index))
+        {
+            task->run();
+            continue;
+        }
+
+        //Within a frame new work usually shows up within microseconds, so spin before parking
+        bool found = false;
+        for (int spin = 0; spin < spin_count && !found; spin++)
+        {
+            if (pending.load(std::memory_order_relaxed) > 0)
+                found = true;
+            else
+                _mm_pause();
+        }
+        if (found) continue;
+
+        std::unique_lock<std::mutex> lock(park_mutex);
+        if (stop && pending.load() <= 0) break;
+
+        sleeping++;
+        park.wait(lock, [this] { return stop || pending.load() > 0; });
+        sleeping--;
+    }
+}
+
+} // namespace Tmpl8
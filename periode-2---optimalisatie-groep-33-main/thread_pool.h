@@ -3,97 +3,318 @@
 namespace Tmpl8
 {
 
-class ThreadPool; //Forward declare
+// -----------------------------------------------------------
+// Type erased callable. Callables up to inline_size bytes are
+// stored in the task itself, larger ones are moved to the heap.
+// Tasks come from a ring per thread that is reused every frame,
+// so scheduling a small task does not allocate.
+// -----------------------------------------------------------
+class Task
+{
+  public:
+    static constexpr size_t inline_size = 48;
+
+    template <class F>
+    static Task* create(F&& function);
+
+    //Run the callable, destroy it and give the task back to its ring
+    void run();
+
+  private:
+    friend class TaskRing;
+
+    template <class F>
+    static void store(Task* task, F&& function, std::true_type /*fits inline*/);
+    template <class F>
+    static void store(Task* task, F&& function, std::false_type /*fits inline*/);
+
+    static Task* allocate();
+    static void release(Task* task);
+
+    alignas(std::max_align_t) unsigned char storage[inline_size];
+    void (*invoke)(Task& task) = nullptr;
+    std::atomic<bool> in_use{false};
+    bool from_heap = false;
+};
+
+//Recycled tasks of one thread, the thread that finishes a task marks its slot free again
+class TaskRing
+{
+  public:
+    static constexpr size_t size = 4096;
+
+    TaskRing() : tasks(new Task[size]) {}
+
+    Task* allocate();
+
+  private:
+    std::unique_ptr<Task[]> tasks;
+    size_t next = 0;
+};
+
+template <class F>
+Task* Task::create(F&& function)
+{
+    typedef typename std::decay<F>::type Function;
+    Task* task = allocate();
+    store(task, std::forward<F>(function), std::integral_constant<bool, sizeof(Function) <= inline_size && alignof(Function) <= alignof(std::max_align_t)>());
+    return task;
+}
+
+template <class F>
+void Task::store(Task* task, F&& function, std::true_type)
+{
+    typedef typename std::decay<F>::type Function;
+    new (task->storage) Function(std::forward<F>(function));
+    task->invoke = [](Task& self) {
+        Function& stored = *reinterpret_cast<Function*>(self.storage);
+        stored();
+        stored.~Function();
+    };
+}
+
+template <class F>
+void Task::store(Task* task, F&& function, std::false_type)
+{
+    typedef typename std::decay<F>::type Function;
+    Function* stored = new Function(std::forward<F>(function));
+    memcpy(task->storage, &stored, sizeof(stored));
+    task->invoke = [](Task& self) {
+        Function* stored;
+        memcpy(&stored, self.storage, sizeof(stored));
+        (*stored)();
+        delete stored;
+    };
+}
 
-class Worker;
+inline void Task::run()
+{
+    invoke(*this);
+    release(this);
+}
 
-class Worker
+// -----------------------------------------------------------
+// Chase-Lev work stealing deque of fixed capacity: the owning
+// worker pushes and pops at the bottom, other threads steal
+// from the top. Lock free, see Le et al. 2013, "Correct and
+// Efficient Work-Stealing for Weak Memory Models".
+// -----------------------------------------------------------
+class WorkStealingDeque
 {
   public:
-    //Instantiate the worker class by passing and storing the threadpool as a reference
-    Worker(ThreadPool& s) : pool(s) {}
+    static constexpr int64_t capacity = 4096;
+
+    //Owner only, false when the deque is full
+    bool push(Task* task);
 
-    inline void operator()();
+    //Owner only, nullptr when the deque is empty
+    Task* pop();
+
+    //Any thread, nullptr when the deque is empty or another thread won the race
+    Task* steal();
+
+    bool empty() const { return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed); }
 
   private:
-    ThreadPool& pool;
+    //top and bottom on their own cache lines, stealers hammer top while the owner works on bottom
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    alignas(64) std::array<std::atomic<Task*>, capacity> buffer;
 };
 
+// -----------------------------------------------------------
+// Work stealing thread pool. Every worker has its own deque,
+// tasks submitted by a worker go to its own deque and tasks
+// submitted by other threads go to a shared injection queue.
+// Idle workers steal from the others, spin for a short while
+// and then park until new work arrives.
+// With a topology the workers are spread over the CPUs domain by
+// domain and steal from workers in their own L3/NUMA domain first.
+// -----------------------------------------------------------
 class ThreadPool
 {
   public:
-    ThreadPool(size_t numThreads) : stop(false)
-    {
-        for (size_t i = 0; i < numThreads; ++i)
-            workers.push_back(std::thread(Worker(*this)));
-    }
+    ThreadPool(size_t numThreads);
+    //pin restricts every worker to the CPU the topology places it on
+    ThreadPool(size_t numThreads, const CpuTopology& topology, bool pin);
+    ~ThreadPool();
 
-    ~ThreadPool()
-    {
-        stop = true; // stop all threads
-        condition.notify_all();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
 
-        for (auto& thread : workers)
-            thread.join();
-    }
+    size_t size() const { return workers.size(); }
 
+    //Run a task on the pool, the future becomes ready once it has run
     template <class T>
-    auto enqueue(T task) -> std::future<decltype(task())>
-    {
-        //Wrap the function in a packaged_task so we can return a future object
-        auto wrapper = std::make_shared<std::packaged_task<decltype(task())()>>(std::move(task));
+    auto enqueue(T task) -> std::future<decltype(task())>;
 
-        //Scope to restrict critical section
-        {
-            //lock our queue and add the given task to it
-            std::unique_lock<std::mutex> lock(queue_mutex);
+    //Run a task on the pool without a way to wait for it
+    template <class F>
+    void submit(F&& function) { schedule(Task::create(std::forward<F>(function))); }
 
-            tasks.push_back([=] {
-                (*wrapper)();
-            });
-        }
+    //Run one queued task on the calling thread, returns false if there was none
+    bool run_one();
 
-        //Wake up a thread to start this task
-        condition.notify_one();
+    //Call fn(i) for every i in [first, last) in parallel and return once all calls are done.
+    //The range is cut in chunks of at least grain indices, 0 picks a chunk size from the thread count.
+    //The calling thread works along, so this may also be called from inside a task.
+    template <class F>
+    void parallel_for(size_t first, size_t last, size_t grain, F&& fn);
 
-        return wrapper->get_future();
-    }
+    //parallel_for for threads outside the pool that must not pick up unrelated work, like the render
+    //thread next to the update: while it waits the calling thread only runs chunks of this loop
+    template <class F>
+    void parallel_for_isolated(size_t first, size_t last, size_t grain, F&& fn);
+
+    //Combine map(i) for every i in [first, last), every chunk is folded starting from identity and
+    //the chunk results are combined in index order, so the result only depends on the chunking
+    template <class T, class Map, class Combine>
+    T parallel_reduce(size_t first, size_t last, size_t grain, T identity, Map&& map, Combine&& combine);
+
+    //Index of the calling worker thread, -1 when called from a thread outside of any pool
+    static int worker_index();
 
   private:
-    friend class Worker; //Gives access to the private variables of this class
+    //Spin iterations before an idle worker parks
+    static constexpr int spin_count = 2048;
+
+    //Most chunks parallel_reduce keeps partial results for, they live on the stack
+    static constexpr size_t max_reduce_chunks = 256;
+
+    void schedule(Task* task);
+
+    size_t chunk_size(size_t count, size_t grain) const;
 
+    //Call fn(chunk, begin, end) for every chunk of [first, last), chunks are claimed by the calling
+    //thread and up to one helper task per worker. Nothing is allocated, all state lives on the stack.
+    //With help_others the calling thread runs other queued tasks while it waits for the helpers.
+    template <class F>
+    void for_each_chunk(size_t first, size_t last, size_t chunk, F& fn, bool help_others = true);
+
+    Task* take(int worker);
+    void work(size_t index);
+
+    void start(size_t numThreads, const std::vector<int>& domains);
+
+    std::vector<std::unique_ptr<WorkStealingDeque>> deques;
+    std::vector<std::unique_ptr<TaskRing>> rings;
     std::vector<std::thread> workers;
-    std::deque<std::function<void()>> tasks;
 
-    std::condition_variable condition; //Wakes up a thread when work is available
+    //Per worker the workers to steal from, same domain first, the last list is for threads outside the pool
+    std::vector<std::vector<size_t>> victims;
+
+    //Tasks from threads outside the pool
+    std::mutex injection_mutex;
+    std::deque<Task*> injection;
+
+    //Queued tasks that have not been taken yet, workers only park when this is zero
+    std::atomic<int64_t> pending{0};
 
-    std::mutex queue_mutex; //Lock for our queue
-    bool stop = false;
+    std::atomic<int> sleeping{0};
+    std::mutex park_mutex;
+    std::condition_variable park;
+
+    std::atomic<bool> stop{false};
 };
 
-inline void Worker::operator()()
+template <class T>
+auto ThreadPool::enqueue(T task) -> std::future<decltype(task())>
 {
-    std::function<void()> task;
-    while (true)
-    {
-        //Scope to restrict critical section
-        //This is important because we don't want to hold the lock while executing the task,
-        //because that would make it so only one task can be run simultaneously (aka sequantial)
-        {
-            std::unique_lock<std::mutex> locker(pool.queue_mutex);
+    typedef decltype(task()) Result;
+
+    //The packaged task is only a pointer to its shared state, so it fits inline in the Task
+    std::packaged_task<Result()> packaged(std::move(task));
+    std::future<Result> future = packaged.get_future();
+    submit([packaged = std::move(packaged)]() mutable { packaged(); });
+    return future;
+}
 
-            //Wait until some work is ready or we are stopping the threadpool
-            //Because of spurious wakeups we need to check if there is actually a task available or we are stopping
-            pool.condition.wait(locker, [=] { return pool.stop || !pool.tasks.empty(); });
+inline size_t ThreadPool::chunk_size(size_t count, size_t grain) const
+{
+    if (grain > 0) return grain;
 
-            if (pool.stop) break;
+    //A few chunks per thread, so threads that finish early can take over work from slow ones
+    return std::max<size_t>(1, count / ((workers.size() + 1) * 4));
+}
 
-            task = pool.tasks.front();
-            pool.tasks.pop_front();
+template <class F>
+void ThreadPool::for_each_chunk(size_t first, size_t last, size_t chunk, F& fn, bool help_others)
+{
+    const size_t chunks = (last - first + chunk - 1) / chunk;
+
+    std::atomic<size_t> next_chunk{0};
+    auto run_chunks = [&]() {
+        for (size_t c = next_chunk++; c < chunks; c = next_chunk++)
+        {
+            fn(c, first + c * chunk, std::min(last, first + (c + 1) * chunk));
         }
+    };
 
-        task();
+    //Helpers reference this stack frame, so it has to wait until every one of them has run
+    const size_t helpers = std::min(chunks - 1, workers.size());
+    std::atomic<size_t> running{helpers};
+    for (size_t h = 0; h < helpers; h++)
+    {
+        submit([&run_chunks, &running] {
+            run_chunks();
+            running.fetch_sub(1, std::memory_order_release);
+        });
+    }
+
+    run_chunks();
+
+    //Run other queued tasks while waiting, this thread may be the only one able to run the helpers
+    while (running.load(std::memory_order_acquire) > 0)
+    {
+        if (!help_others)
+            std::this_thread::yield();
+        else if (!run_one())
+            _mm_pause();
     }
 }
 
-} // namespace Tmpl8
\ No newline at end of file
+template <class F>
+void ThreadPool::parallel_for(size_t first, size_t last, size_t grain, F&& fn)
+{
+    if (first >= last) return;
+
+    auto run = [&fn](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) fn(i);
+    };
+    for_each_chunk(first, last, chunk_size(last - first, grain), run);
+}
+
+template <class F>
+void ThreadPool::parallel_for_isolated(size_t first, size_t last, size_t grain, F&& fn)
+{
+    if (first >= last) return;
+
+    //Helpers that start after the calling thread claimed every chunk return right away
+    auto run = [&fn](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) fn(i);
+    };
+    for_each_chunk(first, last, chunk_size(last - first, grain), run, false);
+}
+
+template <class T, class Map, class Combine>
+T ThreadPool::parallel_reduce(size_t first, size_t last, size_t grain, T identity, Map&& map, Combine&& combine)
+{
+    if (first >= last) return identity;
+
+    const size_t count = last - first;
+    const size_t chunk = std::max(chunk_size(count, grain), (count + max_reduce_chunks - 1) / max_reduce_chunks);
+
+    std::array<T, max_reduce_chunks> partials;
+    auto run = [&](size_t c, size_t begin, size_t end) {
+        T partial = identity;
+        for (size_t i = begin; i < end; i++) partial = combine(partial, map(i));
+        partials[c] = partial;
+    };
+    for_each_chunk(first, last, chunk, run);
+
+    T result = identity;
+    for (size_t c = 0, chunks = (count + chunk - 1) / chunk; c < chunks; c++) result = combine(result, partials[c]);
+    return result;
+}
+
+} // namespace Tmpl8